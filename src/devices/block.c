@@ -3,7 +3,9 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A block device. */
 struct block
@@ -19,6 +21,19 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Buffer cache events, indexed by enum block_cache_event. */
+    unsigned long long cache_cnt[BLOCK_CACHE_EVENT_CNT];
+
+    /* Request statistics.  Updated from the driver's thread as
+       well as the submitter's, so protected by disabling
+       interrupts. */
+    struct blkstat stats;               /* Totals so far. */
+    uint32_t in_flight;                 /* Requests submitted, not done. */
+    uint64_t depth_changed;             /* Cycle count when IN_FLIGHT
+                                           last changed. */
+    block_sector_t next_sector;         /* Just past the last request. */
+    uint64_t registered;                /* Cycle count at registration. */
   };
 
 /* List of all block devices. */
@@ -28,6 +43,8 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void begin_request (struct block *, struct block_request *);
+static void request_done (struct block_request *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -99,20 +116,75 @@ block_get_by_name (const char *name)
   return NULL;
 }
 
-/* Verifies that SECTOR is a valid offset within BLOCK.
-   Panics if not. */
+/* Verifies that the CNT sectors starting at SECTOR are valid
+   offsets within BLOCK.  Panics if not. */
 static void
-check_sector (struct block *block, block_sector_t sector)
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
 {
-  if (sector >= block->size)
+  if (sector >= block->size || cnt > block->size - sector)
     {
       /* We do not use ASSERT because we want to panic here
          regardless of whether NDEBUG is defined. */
       PANIC ("Access past end of device %s (sector=%"PRDSNu", "
-             "size=%"PRDSNu")\n", block_name (block), sector, block->size);
+             "count=%zu, size=%"PRDSNu")\n", block_name (block), sector,
+             cnt, block->size);
     }
 }
 
+/* Completion function for the requests made by transfer(). */
+static void
+transfer_done (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Hands request R to BLOCK's driver.  Drivers without SUBMIT
+   move one sector at a time, and R is done on return. */
+static void
+dispatch (struct block *block, struct block_request *r)
+{
+  if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, r);
+  else
+    {
+      block_sector_t sector = r->sector;
+      uint8_t *buffer = r->buffer;
+      size_t cnt;
+
+      for (cnt = r->cnt; cnt > 0; cnt--, sector++, buffer += BLOCK_SECTOR_SIZE)
+        if (r->write)
+          block->ops->write (block->aux, sector, buffer);
+        else
+          block->ops->read (block->aux, sector, buffer);
+      r->done (r);
+    }
+}
+
+/* Submits a request to transfer the CNT sectors of BLOCK
+   starting at SECTOR to or from BUFFER, and waits for it to
+   finish. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          size_t cnt, void *buffer)
+{
+  struct block_request r;
+  struct semaphore done;
+
+  check_sectors (block, sector, cnt);
+  ASSERT (!write || block->type != BLOCK_FOREIGN);
+
+  sema_init (&done, 0);
+  r.write = write;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.done = transfer_done;
+  r.aux = &done;
+  begin_request (block, &r);
+  dispatch (block, &r);
+  sema_down (&done);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +192,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +203,142 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes, as a single request if the driver allows. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  transfer (block, false, sector, cnt, buffer);
+  block->read_cnt += cnt;
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes,
+   as a single request if the driver allows.  Returns after the
+   block device has acknowledged receiving the data. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  transfer (block, true, sector, cnt, (void *) buffer);
+  block->write_cnt += cnt;
+}
+
+/* Starts request R on BLOCK and returns, usually before the
+   transfer is done.  R->DONE is called when it is.  Requests
+   may be carried out in a different order from the one they
+   were submitted in, so that the disk head sweeps across them. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  check_sectors (block, r->sector, r->cnt);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+  if (r->write)
+    block->write_cnt += r->cnt;
+  else
+    block->read_cnt += r->cnt;
+
+  /* A request that a partition passes on to its disk counts
+     only in the partition's statistics. */
+  if (r->done != request_done)
+    begin_request (block, r);
+  dispatch (block, r);
+}
+
+/* Returns the CPU's time stamp counter. */
+static uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Adds the time since BLOCK's queue depth last changed, up to
+   NOW, to BLOCK's statistics.  Interrupts must be off. */
+static void
+account_depth (struct block *block, uint64_t now)
+{
+  uint64_t elapsed = now - block->depth_changed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  block->stats.depth_cycles += elapsed * block->in_flight;
+  if (block->in_flight > 0)
+    block->stats.busy_cycles += elapsed;
+  block->depth_changed = now;
+}
+
+/* Records the submission of request R to BLOCK in BLOCK's
+   statistics, and arranges for request_done() to record its
+   completion before R's own DONE is called. */
+static void
+begin_request (struct block *block, struct block_request *r)
+{
+  struct blkstat *s = &block->stats;
+  int dir = r->write ? BLKSTAT_WRITE : BLKSTAT_READ;
+  enum intr_level old_level;
+
+  r->block = block;
+  r->client_done = r->done;
+  r->done = request_done;
+
+  old_level = intr_disable ();
+  r->start = rdtsc ();
+  account_depth (block, r->start);
+  s->requests[dir]++;
+  s->bytes[dir] += (uint64_t) r->cnt * BLOCK_SECTOR_SIZE;
+  if (r->sector == block->next_sector)
+    s->sequential++;
+  block->next_sector = r->sector + r->cnt;
+  s->depth[(block->in_flight < BLKSTAT_DEPTHS
+            ? block->in_flight : BLKSTAT_DEPTHS - 1)]++;
+  if (++block->in_flight > s->depth_max)
+    s->depth_max = block->in_flight;
+  intr_set_level (old_level);
+}
+
+/* Completion function for every request: records R's latency
+   and passes R on to the submitter's DONE. */
+static void
+request_done (struct block_request *r)
+{
+  struct block *block = r->block;
+  int dir = r->write ? BLKSTAT_WRITE : BLKSTAT_READ;
+  enum intr_level old_level;
+  uint64_t now, cycles;
+  int bucket;
+
+  old_level = intr_disable ();
+  now = rdtsc ();
+  account_depth (block, now);
+  block->in_flight--;
+  for (bucket = 0, cycles = now - r->start; cycles > 1; cycles >>= 1)
+    if (bucket < BLKSTAT_BUCKETS - 1)
+      bucket++;
+  block->stats.latency[dir][bucket]++;
+  intr_set_level (old_level);
+
+  r->done = r->client_done;
+  r->done (r);
+}
+
+/* Copies BLOCK's request statistics so far into *STATS. */
+void
+block_get_stats (struct block *block, struct blkstat *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  uint64_t now = rdtsc ();
+
+  account_depth (block, now);
+  *stats = block->stats;
+  stats->cycles = now - block->registered;
+  intr_set_level (old_level);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +362,52 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Prints the nonempty buckets of latency histogram HIST for
+   BLOCK's requests in direction DIR, named NAME. */
+static void
+print_latency (struct block *block, const char *name, const uint64_t *hist)
+{
+  int i;
+
+  printf ("%s (%s): %s latency (log2 cycles: requests):",
+          block->name, block_type_name (block->type), name);
+  for (i = 0; i < BLKSTAT_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf (" %d:%"PRIu64, i, hist[i]);
+  printf ("\n");
+}
+
+/* Prints BLOCK's request statistics, if it has had any
+   requests. */
+static void
+print_request_stats (struct block *block)
+{
+  struct blkstat s;
+  uint64_t requests, depth;
+
+  block_get_stats (block, &s);
+  requests = s.requests[BLKSTAT_READ] + s.requests[BLKSTAT_WRITE];
+  if (requests == 0)
+    return;
+
+  /* Mean queue depth, in hundredths. */
+  depth = s.cycles > 0 ? s.depth_cycles * 100 / s.cycles : 0;
+  printf ("%s (%s): %'"PRIu64" bytes read, %'"PRIu64" bytes written, "
+          "%"PRIu64"%% sequential\n",
+          block->name, block_type_name (block->type),
+          s.bytes[BLKSTAT_READ], s.bytes[BLKSTAT_WRITE],
+          s.sequential * 100 / requests);
+  printf ("%s (%s): queue depth mean %"PRIu64".%02"PRIu64", max %"PRIu32", "
+          "busy %"PRIu64"%%\n",
+          block->name, block_type_name (block->type),
+          depth / 100, depth % 100, s.depth_max,
+          s.cycles > 0 ? s.busy_cycles * 100 / s.cycles : 0);
+  if (s.requests[BLKSTAT_READ] > 0)
+    print_latency (block, "read", s.latency[BLKSTAT_READ]);
+  if (s.requests[BLKSTAT_WRITE] > 0)
+    print_latency (block, "write", s.latency[BLKSTAT_WRITE]);
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -174,10 +422,27 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          print_request_stats (block);
+          if (block->cache_cnt[BLOCK_CACHE_HIT] != 0
+              || block->cache_cnt[BLOCK_CACHE_MISS] != 0)
+            printf ("%s (%s): %llu cache hits, %llu misses, "
+                    "%llu evictions\n",
+                    block->name, block_type_name (block->type),
+                    block->cache_cnt[BLOCK_CACHE_HIT],
+                    block->cache_cnt[BLOCK_CACHE_MISS],
+                    block->cache_cnt[BLOCK_CACHE_EVICT]);
         }
     }
 }
 
+/* Records buffer cache EVENT against BLOCK. */
+void
+block_cache_event (struct block *block, enum block_cache_event event)
+{
+  ASSERT (event < BLOCK_CACHE_EVENT_CNT);
+  block->cache_cnt[event]++;
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -200,6 +465,12 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  memset (block->cache_cnt, 0, sizeof block->cache_cnt);
+  memset (&block->stats, 0, sizeof block->stats);
+  strlcpy (block->stats.name, name, sizeof block->stats.name);
+  block->in_flight = 0;
+  block->next_sector = 0;
+  block->registered = block->depth_changed = rdtsc ();
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -2,7 +2,10 @@
 #define DEVICES_BLOCK_H
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <inttypes.h>
+#include <list.h>
+#include <blkstat.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -49,22 +52,79 @@ struct block *block_get_by_name (const char *name);
 struct block *block_first (void);
 struct block *block_next (struct block *);
 
+/* Asynchronous block request.
+
+   The submitter fills in WRITE, SECTOR, CNT, BUFFER, DONE and AUX and
+   passes the request to block_submit(), which returns without
+   waiting for the transfer.  When it is finished, DONE is called
+   with the request, typically from the driver's own thread, so it
+   must not block for long.  The request and its buffer must stay
+   put until then.  SECTOR may have been changed by then, as when
+   a partition passes the request on to its disk. */
+struct block_request;
+typedef void block_done_func (struct block_request *);
+
+struct block_request
+  {
+    bool write;                 /* Write, or read? */
+    block_sector_t sector;      /* First sector to transfer. */
+    size_t cnt;                 /* Number of consecutive sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes of data. */
+    block_done_func *done;      /* Called when finished. */
+    void *aux;                  /* For DONE's use. */
+
+    /* Owned by the driver. */
+    struct list_elem elem;      /* Element in a request queue. */
+    void *private;              /* Driver's data. */
+    uint32_t *pagedir;          /* Page directory active at submission,
+                                   which maps BUFFER if it is in user
+                                   memory. */
+
+    /* Owned by the block layer. */
+    struct block *block;        /* Device whose statistics count it. */
+    block_done_func *client_done;   /* Submitter's DONE. */
+    uint64_t start;             /* Cycle count at submission. */
+  };
+
 /* Block device operations. */
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
+void block_submit (struct block *, struct block_request *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
 void block_print_stats (void);
+void block_get_stats (struct block *, struct blkstat *);
+
+/* Buffer cache events, counted per block device by the file
+   system's buffer cache and reported by block_print_stats(). */
+enum block_cache_event
+  {
+    BLOCK_CACHE_HIT,             /* Sector found in the cache. */
+    BLOCK_CACHE_MISS,            /* Sector not found in the cache. */
+    BLOCK_CACHE_EVICT,           /* Cached sector evicted. */
+    BLOCK_CACHE_EVENT_CNT
+  };
+
+void block_cache_event (struct block *, enum block_cache_event);
 
 /* Lower-level interface to block device drivers. */
 
+/* A driver provides either READ and WRITE, which move a single
+   sector and return when the transfer is done, or SUBMIT, which
+   queues a request for any number of consecutive sectors and
+   returns right away.  The block layer makes up the others from
+   those. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
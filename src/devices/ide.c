@@ -3,15 +3,41 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Requests for the disks on a channel are queued, and a
+   dispatcher thread per channel carries them out one at a time.
+   It takes them in C-LOOK order: the next request is the one
+   with the lowest sector at or past the last one, or if there is
+   none, the lowest of all, so that the disk head sweeps across
+   the queued requests in one direction and then starts over.
+   Submitters do not wait unless they want to.
+
+   If the channels belong to a PCI bus-master IDE controller, such
+   as the PIIX that QEMU and Bochs emulate, and a disk supports
+   DMA, data moves by DMA: the controller copies it directly
+   between the disk and the physical pages of the request's
+   buffer, described by a table of physical region descriptors
+   (PRDs), and interrupts once when the whole command is done.
+   Otherwise, and whenever DMA fails, data moves by PIO, with the
+   CPU copying every word through the data register.
+
+   The dispatcher does not run in the submitter's address space,
+   so a buffer in user memory is reached through the page
+   directory that was active when the request was submitted. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +60,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -43,12 +70,49 @@
 #define DEV_LBA 0x40            /* Linear based addressing. */
 #define DEV_DEV 0x10            /* Select device: 0=master, 1=slave. */
 
+/* Bus master port addresses, relative to the channel's bus
+   master base. */
+#define bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)    /* Command. */
+#define bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)     /* Status. */
+#define bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)       /* PRD table address. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start/stop transfer. */
+#define BM_CMD_READ 0x08        /* Transfer to memory (a disk read). */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error, write 1 to clear. */
+#define BM_STA_INTR 0x04        /* Interrupt, write 1 to clear. */
+
 /* Commands.
    Many more are defined but this is the small subset that we
    use. */
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors a single command can transfer, written to the
+   sector count register as 0. */
+#define MAX_COMMAND_SECTORS 256
+
+/* A physical region descriptor: one physically contiguous piece
+   of a DMA transfer, which must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT, or 0. */
+  };
+
+#define PRD_EOT 0x8000          /* Last descriptor in the table. */
+
+/* Number of PRDs in a channel's table, which fills a page. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +121,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt with READ and
+                                   WRITE MULTIPLE, or 0 if not used. */
+    bool dma;                   /* Transfer data by DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -66,12 +133,20 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master base I/O port, or 0. */
+    struct prd *prdt;           /* PRD table, a page, if BM_BASE != 0. */
+    uint8_t bounce[BLOCK_SECTOR_SIZE];  /* PIO buffer for user memory. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    struct lock lock;           /* Protects the members below. */
+    struct condition queued;    /* Signaled when a request is queued. */
+    struct list queue;          /* Requests not yet started. */
+    uint64_t head;              /* Position just past the last request
+                                   started, see request_pos(). */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -81,14 +156,19 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
+static void input_request (struct channel *, struct block_request *,
+                           size_t ofs, size_t cnt);
+static void output_request (struct channel *, struct block_request *,
+                            size_t ofs, size_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -96,11 +176,13 @@ static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static thread_func dispatcher NO_RETURN;
 
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,9 +205,20 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      lock_init (&c->lock);
+      cond_init (&c->queued);
+      list_init (&c->queue);
+      c->head = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +229,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -148,6 +243,9 @@ ide_init (void)
       if (check_device_type (&c->devices[0]))
         check_device_type (&c->devices[1]);
 
+      /* Start the dispatcher, which partition scanning needs. */
+      thread_create (c->name, PRI_MAX, dispatcher, c);
+
       /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
@@ -155,9 +253,72 @@ ide_init (void)
     }
 }
 
+/* PCI configuration space ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* PCI configuration registers. */
+#define PCI_REG_ID 0x00         /* Device and vendor ID. */
+#define PCI_REG_COMMAND 0x04    /* Status and command. */
+#define PCI_REG_CLASS 0x08      /* Class, subclass, prog-if, revision. */
+#define PCI_REG_BAR4 0x20       /* Base address register 4. */
+
+/* PCI Command Register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* Bus master enable. */
+
+/* Returns the address that selects configuration register REG
+   of function FUNC of device DEV on PCI bus 0. */
+static uint32_t
+pci_config_addr (int dev, int func, int reg)
+{
+  return 0x80000000 | (dev << 11) | (func << 8) | (reg & 0xfc);
+}
+
+/* Finds an IDE controller on PCI bus 0 that can act as a bus
+   master, and enables it to.  Returns the I/O port base of its
+   bus master registers, or 0 if there is none. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4, command;
+
+        outl (PCI_CONFIG_ADDR, pci_config_addr (dev, func, PCI_REG_ID));
+        if ((inl (PCI_CONFIG_DATA) & 0xffff) == 0xffff)
+          continue;
+
+        /* Mass storage controller (class 1), IDE (subclass 1),
+           bus master capable (bit 7 of prog-if). */
+        outl (PCI_CONFIG_ADDR, pci_config_addr (dev, func, PCI_REG_CLASS));
+        class = inl (PCI_CONFIG_DATA);
+        if ((class >> 16) != 0x0101 || (class & 0x8000) == 0)
+          continue;
+
+        /* The bus master registers are in I/O space. */
+        outl (PCI_CONFIG_ADDR, pci_config_addr (dev, func, PCI_REG_BAR4));
+        bar4 = inl (PCI_CONFIG_DATA);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Writing 0 to the status half changes nothing. */
+        outl (PCI_CONFIG_ADDR, pci_config_addr (dev, func, PCI_REG_COMMAND));
+        command = inl (PCI_CONFIG_DATA) & 0xffff;
+        outl (PCI_CONFIG_DATA, command | PCI_CMD_IO | PCI_CMD_MASTER);
+
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
+static void set_multiple_mode (struct ata_disk *, int max);
 
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
@@ -279,7 +440,7 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,12 +464,45 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Move several sectors per interrupt, if the disk can. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+
+  /* Use DMA if both the disk and the controller can. */
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x0100) != 0;
+  if (d->dma)
+    strlcat (extra_info, ", DMA", sizeof extra_info);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Enables READ and WRITE MULTIPLE on disk D with the largest
+   power of 2 sectors per interrupt that is at most MAX, which
+   IDENTIFY DEVICE reported.  Leaves them disabled if MAX is 0 or
+   the disk refuses. */
+static void
+set_multiple_mode (struct ata_disk *d, int max)
+{
+  struct channel *c = d->channel;
+  int cnt;
+
+  d->multiple = 0;
+  if (max <= 1)
+    return;
+  for (cnt = 1; cnt * 2 <= max; cnt *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +531,306 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+/* Returns the page directory that the CPU is using. */
+static uint32_t *
+active_pd (void)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  uintptr_t pd;
+  asm volatile ("movl %%cr3, %0" : "=r" (pd));
+  return ptov (pd);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Queues request R for disk D and returns.  The channel's
+   dispatcher thread carries it out. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_submit (void *d_, struct block_request *r)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
+  r->private = d;
+  r->pagedir = active_pd ();
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  list_push_back (&c->queue, &r->elem);
+  cond_signal (&c->queued, &c->lock);
   lock_release (&c->lock);
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    ide_submit
   };
-
+
+/* Returns the position of request R on its channel, which
+   orders requests by disk, then by sector. */
+static uint64_t
+request_pos (const struct block_request *r)
+{
+  const struct ata_disk *d = r->private;
+  return ((uint64_t) d->dev_no << 32) | r->sector;
+}
+
+/* Removes and returns the request in C's queue that comes next
+   in C-LOOK order.  Requests for the same position are taken in
+   the order they were queued.  C's lock must be held. */
+static struct block_request *
+next_request (struct channel *c)
+{
+  struct block_request *next = NULL;
+  struct block_request *lowest = NULL;
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (!list_empty (&c->queue));
+
+  for (e = list_begin (&c->queue); e != list_end (&c->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      uint64_t pos = request_pos (r);
+
+      if (lowest == NULL || pos < request_pos (lowest))
+        lowest = r;
+      if (pos >= c->head && (next == NULL || pos < request_pos (next)))
+        next = r;
+    }
+  if (next == NULL)
+    next = lowest;
+
+  list_remove (&next->elem);
+  c->head = request_pos (next) + 1;
+  return next;
+}
+
+/* Returns the kernel virtual address of byte OFS of request R's
+   buffer, which may be in user memory, or a null pointer if it
+   is not mapped. */
+static uint8_t *
+buffer_kaddr (const struct block_request *r, size_t ofs)
+{
+  const uint8_t *addr = (const uint8_t *) r->buffer + ofs;
+  uint32_t pde, pte;
+
+  if (is_kernel_vaddr (addr))
+    return (uint8_t *) addr;
+
+  pde = r->pagedir[pd_no (addr)];
+  if ((pde & PTE_P) == 0)
+    return NULL;
+  pte = pde_get_pt (pde)[pt_no (addr)];
+  if ((pte & PTE_P) == 0)
+    return NULL;
+  return (uint8_t *) pte_get_page (pte) + pg_ofs (addr);
+}
+
+/* Copies SIZE bytes between BOUNCE and request R's buffer,
+   starting OFS bytes into it: out of the buffer for a write,
+   into it for a read. */
+static void
+copy_request (struct block_request *r, size_t ofs, uint8_t *bounce,
+              size_t size)
+{
+  while (size > 0)
+    {
+      uint8_t *kaddr = buffer_kaddr (r, ofs);
+      size_t n;
+
+      if (kaddr == NULL)
+        PANIC ("disk buffer %p not mapped", (uint8_t *) r->buffer + ofs);
+      n = PGSIZE - pg_ofs (kaddr);
+      if (n > size)
+        n = size;
+      if (r->write)
+        memcpy (bounce, kaddr, n);
+      else
+        memcpy (kaddr, bounce, n);
+      ofs += n;
+      bounce += n;
+      size -= n;
+    }
+}
+
+/* Carries out the CNT sectors of request R on disk D that start
+   FIRST sectors into it, in PIO mode, as a single command.  The
+   command interrupts once per sector, or once per D->MULTIPLE
+   sectors with READ and WRITE MULTIPLE. */
+static void
+transfer_pio (struct ata_disk *d, struct block_request *r,
+              size_t first, size_t cnt)
+{
+  struct channel *c = d->channel;
+  block_sector_t sector = r->sector + first;
+  size_t per_int = d->multiple > 0 ? (size_t) d->multiple : 1;
+  size_t ofs;
+
+  select_sectors (d, sector, cnt);
+  if (!r->write)
+    {
+      issue_pio_command (c, (d->multiple > 0 ? CMD_READ_MULTIPLE
+                             : CMD_READ_SECTOR_RETRY));
+      for (ofs = 0; ofs < cnt; ofs += per_int)
+        {
+          size_t n = cnt - ofs < per_int ? cnt - ofs : per_int;
+
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sector + ofs);
+          input_request (c, r, (first + ofs) * BLOCK_SECTOR_SIZE, n);
+        }
+    }
+  else
+    {
+      issue_pio_command (c, (d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                             : CMD_WRITE_SECTOR_RETRY));
+      for (ofs = 0; ofs < cnt; ofs += per_int)
+        {
+          size_t n = cnt - ofs < per_int ? cnt - ofs : per_int;
+
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sector + ofs);
+          output_request (c, r, (first + ofs) * BLOCK_SECTOR_SIZE, n);
+          sema_down (&c->completion_wait);
+        }
+    }
+}
+
+/* Fills in D's channel's PRD table to describe the SIZE bytes of
+   request R's buffer that start OFS bytes into it.  Returns
+   false if the buffer cannot be used for DMA. */
+static bool
+build_prdt (struct ata_disk *d, struct block_request *r,
+            size_t ofs, size_t size)
+{
+  struct prd *prdt = d->channel->prdt;
+  size_t prd_cnt = 0;
+
+  /* The controller moves whole 16-bit words. */
+  if (((uintptr_t) r->buffer + ofs) % 2 != 0)
+    return false;
+
+  /* One descriptor per page, since consecutive user pages need
+     not be consecutive in physical memory.  A page never
+     crosses a 64 kB boundary. */
+  while (size > 0)
+    {
+      uint8_t *kaddr = buffer_kaddr (r, ofs);
+      size_t n;
+
+      if (kaddr == NULL || prd_cnt >= PRD_CNT)
+        return false;
+      n = PGSIZE - pg_ofs (kaddr);
+      if (n > size)
+        n = size;
+      prdt[prd_cnt].addr = vtop (kaddr);
+      prdt[prd_cnt].size = n;
+      prdt[prd_cnt].flags = 0;
+      prd_cnt++;
+      ofs += n;
+      size -= n;
+    }
+  prdt[prd_cnt - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Carries out the CNT sectors of request R on disk D that start
+   FIRST sectors into it, by DMA, as a single command that
+   interrupts when it is done.  Returns false without
+   transferring anything if the buffer cannot be used for DMA,
+   or if the transfer fails, in which case DMA is turned off for
+   D and the caller should fall back to PIO. */
+static bool
+transfer_dma (struct ata_disk *d, struct block_request *r,
+              size_t first, size_t cnt)
+{
+  struct channel *c = d->channel;
+  uint8_t status;
+
+  if (!build_prdt (d, r, first * BLOCK_SECTOR_SIZE, cnt * BLOCK_SECTOR_SIZE))
+    return false;
+
+  /* Set up the controller, then start the disk and the
+     controller, in that order. */
+  outl (bm_prdt (c), vtop (c->prdt));
+  outb (bm_command (c), r->write ? 0 : BM_CMD_READ);
+  outb (bm_status (c), inb (bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+  select_sectors (d, r->sector + first, cnt);
+  issue_pio_command (c, r->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (bm_command (c), inb (bm_command (c)) | BM_CMD_START);
+
+  /* Wait for the completion interrupt, then stop the controller
+     and check for errors. */
+  sema_down (&c->completion_wait);
+  outb (bm_command (c), inb (bm_command (c)) & ~BM_CMD_START);
+  status = inb (bm_status (c));
+  outb (bm_status (c), status | BM_STA_ERR | BM_STA_INTR);
+  if ((status & BM_STA_ERR) != 0 || (inb (reg_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA failed, sector=%"PRDSNu", using PIO\n",
+              d->name, r->sector + first);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
+/* Carries out request R on disk D, returning when the transfer
+   is done.  Each command moves as many of R's sectors as it can,
+   by DMA if possible, otherwise by PIO.  Only the dispatcher
+   calls this, so it has the channel to itself. */
+static void
+transfer (struct ata_disk *d, struct block_request *r)
+{
+  size_t first;
+
+  for (first = 0; first < r->cnt; first += MAX_COMMAND_SECTORS)
+    {
+      size_t left = r->cnt - first;
+      size_t cnt = left < MAX_COMMAND_SECTORS ? left : MAX_COMMAND_SECTORS;
+
+      if (!d->dma || !transfer_dma (d, r, first, cnt))
+        transfer_pio (d, r, first, cnt);
+    }
+}
+
+/* Dispatcher thread for channel C_.  Carries out the queued
+   requests one by one and reports each one's completion. */
+static void
+dispatcher (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      struct block_request *r;
+
+      lock_acquire (&c->lock);
+      while (list_empty (&c->queue))
+        cond_wait (&c->queued, &c->lock);
+      r = next_request (c);
+      lock_release (&c->lock);
+
+      transfer (r->private, r);
+      r->done (r);
+    }
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT of sectors starting there to
+   the disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_COMMAND_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_COMMAND_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -414,22 +851,59 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into request R's buffer, starting OFS bytes into it.  A buffer
+   in user memory is filled a sector at a time, through C's
+   bounce buffer, because its pages are not contiguous in kernel
+   memory. */
+static void
+input_request (struct channel *c, struct block_request *r,
+               size_t ofs, size_t cnt)
+{
+  if (is_kernel_vaddr (r->buffer))
+    input_sectors (c, (uint8_t *) r->buffer + ofs, cnt);
+  else
+    for (; cnt > 0; cnt--, ofs += BLOCK_SECTOR_SIZE)
+      {
+        input_sectors (c, c->bounce, 1);
+        copy_request (r, ofs, c->bounce, BLOCK_SECTOR_SIZE);
+      }
+}
+
+/* Writes CNT sectors from request R's buffer, starting OFS bytes
+   into it, to channel C's data register in PIO mode, as
+   input_request() reads them. */
+static void
+output_request (struct channel *c, struct block_request *r,
+                size_t ofs, size_t cnt)
+{
+  if (is_kernel_vaddr (r->buffer))
+    output_sectors (c, (uint8_t *) r->buffer + ofs, cnt);
+  else
+    for (; cnt > 0; cnt--, ofs += BLOCK_SECTOR_SIZE)
+      {
+        copy_request (r, ofs, c->bounce, BLOCK_SECTOR_SIZE);
+        output_sectors (c, c->bounce, 1);
+      }
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
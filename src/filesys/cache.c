@@ -0,0 +1,653 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Sector number of a cache entry that holds no sector. */
+#define CACHE_NO_SECTOR ((block_sector_t) -1)
+
+/* A cached sector of the file system device.
+
+   SECTOR, PIN_CNT and ACCESSED are protected by cache_lock.
+   DATA, VALID and DIRTY are protected by the entry's LOCK, which
+   is only taken by a thread that has pinned the entry.  An entry
+   with a nonzero PIN_CNT is never evicted, so its SECTOR stays
+   put while its LOCK is held.  HELD is changed only with both
+   locks held, so either one suffices to read it.
+
+   An entry whose SECTOR is a delayed block (see is_delayed()) is
+   neither evicted nor flushed, since it has nowhere to go. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Cached sector. */
+    int pin_cnt;                        /* Number of active users. */
+    bool accessed;                      /* Used since last clock sweep? */
+    bool held;                          /* Kept from disk for the journal? */
+
+    struct lock lock;                   /* Protects the members below. */
+    bool valid;                         /* DATA read in from disk? */
+    bool dirty;                         /* DATA newer than disk? */
+    struct block_request req;           /* Asynchronous transfer of DATA. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;          /* Protects cache metadata. */
+static struct condition cache_unpinned; /* Signaled when a pin drops. */
+static size_t clock_hand;               /* Next eviction candidate. */
+
+/* Sectors queued for the read-ahead thread, a ring buffer.
+   Requests that arrive while the ring is full are dropped.  The
+   thread reads up to RA_BATCH of them at a time, all submitted to
+   the disk together, so that the driver can order them. */
+#define RA_QUEUE_SIZE 64
+#define RA_BATCH 8
+static block_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head;                  /* Next sector to prefetch. */
+static size_t ra_cnt;                   /* Number of queued sectors. */
+static struct lock ra_lock;             /* Protects the ring. */
+static struct condition ra_queued;      /* Signaled when a sector is queued. */
+
+/* Interval at which the flusher thread writes dirty sectors
+   back to disk, in timer ticks. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+static bool is_delayed (block_sector_t);
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_evict (void);
+static void cache_prefetch (const block_sector_t[], size_t cnt);
+static void submit (struct cache_entry *, bool write, struct semaphore *);
+static thread_func readahead_thread NO_RETURN;
+static thread_func flusher_thread NO_RETURN;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->sector = CACHE_NO_SECTOR;
+      e->pin_cnt = 0;
+      e->accessed = false;
+      e->held = false;
+      lock_init (&e->lock);
+      e->valid = false;
+      e->dirty = false;
+    }
+  clock_hand = 0;
+
+  lock_init (&ra_lock);
+  cond_init (&ra_queued);
+  ra_head = ra_cnt = 0;
+  thread_create ("read-ahead", PRI_DEFAULT, readahead_thread, NULL);
+  thread_create ("flusher", PRI_DEFAULT, flusher_thread, NULL);
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS within sector SECTOR
+   into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes,
+   like cache_read().  Each run of them that is not cached is
+   read from disk straight into BUFFER, in a single request,
+   without copying it through the cache or evicting anything to
+   make room for it.  This suits large reads whose data is not
+   likely to be read again soon. */
+void
+cache_read_direct (block_sector_t sector, size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  size_t run = 0;
+  size_t i;
+
+  for (i = 0; i <= cnt; i++)
+    {
+      bool cached = true;
+
+      if (i < cnt)
+        {
+          lock_acquire (&cache_lock);
+          cached = (cache_lookup (sector + i) != NULL
+                    || is_delayed (sector + i));
+          lock_release (&cache_lock);
+        }
+
+      /* A cached sector, possibly dirty, must come from the cache.
+         If one gets cached after we looked, reading it from disk
+         just orders this read before whoever cached it. */
+      if (!cached)
+        run++;
+      else
+        {
+          if (run > 0)
+            {
+              block_sector_t first = sector + i - run;
+
+              block_cache_event (fs_device, BLOCK_CACHE_MISS);
+              block_read_multiple (fs_device, first, run,
+                                   buffer + (i - run) * BLOCK_SECTOR_SIZE);
+              run = 0;
+            }
+          if (i < cnt)
+            cache_read (sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+        }
+    }
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to sector SECTOR, starting at
+   byte OFS within the sector.  The data reaches the disk when
+   the sector is evicted or the cache is flushed. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* A full-sector write need not read the old contents first. */
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER to sector SECTOR, starting at
+   byte OFS within the sector, like cache_write_at().  The sector
+   is then held in the cache and not written back to disk, even
+   by cache_flush(), until cache_unhold() is called for it.  The
+   journal uses this to keep metadata off the disk until it has
+   been logged. */
+void
+cache_hold_write_at (block_sector_t sector, const void *buffer,
+                     size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  lock_acquire (&cache_lock);
+  e->held = true;
+  lock_release (&cache_lock);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Allows SECTOR, held by cache_hold_write_at(), to be written back
+   to disk again. */
+void
+cache_unhold (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  if (e != NULL)
+    e->pin_cnt++;
+  lock_release (&cache_lock);
+  if (e == NULL)
+    return;
+
+  lock_acquire (&e->lock);
+  lock_acquire (&cache_lock);
+  e->held = false;
+  lock_release (&cache_lock);
+  cache_put (e);
+}
+
+/* Moves the delayed block OLD, which must be cached, to sector
+   NEW, which has just been allocated to it.  Its data will be
+   written back to NEW like any other dirty sector.  Any stale
+   copy of NEW left in the cache by the sector's previous owner
+   is dropped first, waiting for whoever is using it to finish.
+   All of this is done in one hold of cache_lock, so that NEW
+   cannot be cached again from disk in between. */
+void
+cache_rename (block_sector_t old, block_sector_t new)
+{
+  struct cache_entry *e;
+
+  ASSERT (is_delayed (old));
+  ASSERT (!is_delayed (new));
+
+  lock_acquire (&cache_lock);
+  while ((e = cache_lookup (new)) != NULL)
+    if (e->pin_cnt > 0)
+      cond_wait (&cache_unpinned, &cache_lock);
+    else
+      {
+        /* Nobody has E pinned, so nobody holds its lock. */
+        e->sector = CACHE_NO_SECTOR;
+        e->held = false;
+        e->valid = false;
+        e->dirty = false;
+
+        /* E is free for cache_evict() now, and waiting above may
+           have taken a wakeup meant for it. */
+        cond_signal (&cache_unpinned, &cache_lock);
+      }
+
+  e = cache_lookup (old);
+  ASSERT (e != NULL);
+  ASSERT (e->pin_cnt == 0);
+  e->sector = new;
+  lock_release (&cache_lock);
+}
+
+/* Drops SECTOR from the cache, if it is there, without writing
+   it back to disk. */
+void
+cache_discard (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  if (e != NULL)
+    e->pin_cnt++;
+  lock_release (&cache_lock);
+  if (e == NULL)
+    return;
+
+  lock_acquire (&e->lock);
+  e->valid = false;
+  e->dirty = false;
+  lock_acquire (&cache_lock);
+  e->held = false;
+  e->sector = CACHE_NO_SECTOR;
+  lock_release (&cache_lock);
+  cache_put (e);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background.  Returns without waiting. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt < RA_QUEUE_SIZE)
+    {
+      ra_queue[(ra_head + ra_cnt) % RA_QUEUE_SIZE] = sector;
+      ra_cnt++;
+      cond_signal (&ra_queued, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Writes every dirty cached sector back to disk, all submitted
+   together, in ascending sector order so that the writes sweep
+   across the disk once.
+   A sector dirtied while the flush is in progress may be left
+   for the next flush.  Held sectors and delayed blocks are
+   skipped.
+   A sector's dirty bit is only cleared once its write is done,
+   so a flush that finds a sector still being written by another
+   flush waits for that write, and on return every sector that
+   was dirty on entry is on disk. */
+void
+cache_flush (void)
+{
+  struct cache_entry *dirty[CACHE_SIZE];
+  size_t dirty_cnt = 0;
+  size_t write_cnt = 0;
+  struct semaphore done;
+  size_t i;
+
+  /* Pin the dirty entries so they stay put while we sort. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->sector != CACHE_NO_SECTOR && !is_delayed (e->sector)
+          && e->dirty && !e->held)
+        {
+          e->pin_cnt++;
+          dirty[dirty_cnt++] = e;
+        }
+    }
+  lock_release (&cache_lock);
+
+  /* Insertion sort by sector number. */
+  for (i = 1; i < dirty_cnt; i++)
+    {
+      struct cache_entry *e = dirty[i];
+      size_t j;
+
+      for (j = i; j > 0 && dirty[j - 1]->sector > e->sector; j--)
+        dirty[j] = dirty[j - 1];
+      dirty[j] = e;
+    }
+
+  /* Start writing all of them at once, keeping each one locked
+     and dirty until its write is done. */
+  sema_init (&done, 0);
+  for (i = 0; i < dirty_cnt; i++)
+    {
+      struct cache_entry *e = dirty[i];
+
+      lock_acquire (&e->lock);
+      if (e->valid && e->dirty && !e->held)
+        {
+          submit (e, true, &done);
+          dirty[write_cnt++] = e;
+        }
+      else
+        cache_put (e);
+    }
+
+  for (i = 0; i < write_cnt; i++)
+    sema_down (&done);
+  for (i = 0; i < write_cnt; i++)
+    {
+      dirty[i]->dirty = false;
+      cache_put (dirty[i]);
+    }
+}
+
+/* Returns true if SECTOR is a delayed block, one with no sector
+   on disk yet. */
+static bool
+is_delayed (block_sector_t sector)
+{
+  return sector >= CACHE_DELAYED_BASE && sector != CACHE_NO_SECTOR;
+}
+
+/* Returns the pinned and locked cache entry for SECTOR, loading
+   it into the cache if necessary.  If LOAD is false, the caller
+   is about to overwrite the whole sector, so a newly cached
+   sector is not read from disk.  Release with cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry *e, *victim;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  if (e != NULL)
+    block_cache_event (fs_device, BLOCK_CACHE_HIT);
+  else
+    {
+      block_cache_event (fs_device, BLOCK_CACHE_MISS);
+      victim = cache_evict ();
+
+      /* SECTOR may have been cached while the victim was written
+         back, in which case the victim is left free. */
+      e = cache_lookup (sector);
+      if (e == NULL)
+        {
+          e = victim;
+          e->sector = sector;
+          e->valid = false;
+          e->dirty = false;
+        }
+    }
+  e->pin_cnt++;
+  e->accessed = true;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (!e->valid && load)
+    {
+      ASSERT (!is_delayed (sector));
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Unlocks and unpins entry E, obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns the cache entry holding SECTOR, or a null pointer if
+   SECTOR is not cached.  cache_lock must be held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an unpinned, unheld cache entry that is not a delayed
+   block with the clock algorithm, writes it back to disk if it
+   is dirty, and returns it, holding no sector.  Waits for an
+   entry to be unpinned if every entry is in use.  cache_lock
+   must be held.  It is released while a victim is written back,
+   so the caller must check again that the sector it wants has
+   not been cached meanwhile. */
+static struct cache_entry *
+cache_evict (void)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      size_t sweep;
+
+      /* Two sweeps give every entry's accessed bit a chance to
+         be cleared. */
+      for (sweep = 0; sweep < 2 * CACHE_SIZE; sweep++)
+        {
+          struct cache_entry *e = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+          if (e->pin_cnt > 0 || e->held || is_delayed (e->sector))
+            continue;
+          if (e->accessed)
+            {
+              e->accessed = false;
+              continue;
+            }
+
+          if (e->sector != CACHE_NO_SECTOR && e->valid && e->dirty)
+            {
+              /* Write E back with it pinned and locked but without
+                 cache_lock, so that other threads can use the
+                 cache meanwhile, as cache_flush() does.  E stays
+                 dirty until the write is done. */
+              e->pin_cnt++;
+              lock_release (&cache_lock);
+              lock_acquire (&e->lock);
+              if (e->valid && e->dirty)
+                {
+                  block_write (fs_device, e->sector, e->data);
+                  e->dirty = false;
+                }
+              lock_release (&e->lock);
+              lock_acquire (&cache_lock);
+
+              /* Someone may have used E while it was written. */
+              if (--e->pin_cnt > 0 || e->held || is_delayed (e->sector)
+                  || e->accessed || (e->valid && e->dirty))
+                {
+                  if (e->pin_cnt == 0)
+                    cond_signal (&cache_unpinned, &cache_lock);
+                  continue;
+                }
+            }
+          if (e->sector != CACHE_NO_SECTOR)
+            block_cache_event (fs_device, BLOCK_CACHE_EVICT);
+          e->sector = CACHE_NO_SECTOR;
+          return e;
+        }
+      cond_wait (&cache_unpinned, &cache_lock);
+    }
+}
+
+/* Completion function for submit(). */
+static void
+submit_done (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Starts reading or writing locked entry E's data from or to
+   disk, and returns.  Ups DONE when the transfer is finished. */
+static void
+submit (struct cache_entry *e, bool write, struct semaphore *done)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  e->req.write = write;
+  e->req.sector = e->sector;
+  e->req.cnt = 1;
+  e->req.buffer = e->data;
+  e->req.done = submit_done;
+  e->req.aux = done;
+  block_submit (fs_device, &e->req);
+}
+
+/* Reads the CNT sectors in SECTORS into the cache, except those
+   already there, submitting all the reads before waiting for
+   any.  Read-ahead is not counted as a cache hit or miss, so that
+   a later read of a prefetched sector shows up as a hit. */
+static void
+cache_prefetch (const block_sector_t sectors[], size_t cnt)
+{
+  struct cache_entry *reading[RA_BATCH];
+  size_t read_cnt = 0;
+  struct semaphore done;
+  size_t i;
+
+  ASSERT (cnt <= RA_BATCH);
+
+  sema_init (&done, 0);
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e;
+
+      if (is_delayed (sectors[i]))
+        continue;
+      lock_acquire (&cache_lock);
+      if (cache_lookup (sectors[i]) != NULL)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e = cache_evict ();
+      if (cache_lookup (sectors[i]) != NULL)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->sector = sectors[i];
+      e->valid = false;
+      e->dirty = false;
+      e->pin_cnt++;
+      e->accessed = true;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (!e->valid)
+        {
+          submit (e, false, &done);
+          reading[read_cnt++] = e;
+        }
+      else
+        cache_put (e);
+    }
+
+  for (i = 0; i < read_cnt; i++)
+    sema_down (&done);
+  for (i = 0; i < read_cnt; i++)
+    {
+      reading[i]->valid = true;
+      cache_put (reading[i]);
+    }
+}
+
+/* Read-ahead thread.  Prefetches the sectors queued by
+   cache_readahead(), oldest first, RA_BATCH at a time. */
+static void
+readahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sectors[RA_BATCH];
+      size_t cnt;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_queued, &ra_lock);
+      for (cnt = 0; cnt < RA_BATCH && ra_cnt > 0; cnt++)
+        {
+          sectors[cnt] = ra_queue[ra_head];
+          ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+          ra_cnt--;
+        }
+      lock_release (&ra_lock);
+
+      cache_prefetch (sectors, cnt);
+    }
+}
+
+/* Flusher thread.  Every FLUSH_INTERVAL ticks, gives delayed
+   blocks their sectors and writes dirty sectors back to disk, so
+   that data written through the cache reaches the disk even if
+   it is never evicted. */
+static void
+flusher_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      inode_assign_delayed ();
+      cache_flush ();
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of sectors held by the buffer cache. */
+#define CACHE_SIZE 64
+
+/* Sector numbers from CACHE_DELAYED_BASE up stand for data
+   blocks that have not been given a sector on disk yet.  Such a
+   block stays in the cache, never written back, until
+   cache_rename() moves it to a real sector or cache_discard()
+   drops it. */
+#define CACHE_DELAYED_BASE ((block_sector_t) 0x80000000)
+
+void cache_init (void);
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, size_t ofs, size_t size);
+void cache_read_direct (block_sector_t, size_t cnt, void *);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void cache_hold_write_at (block_sector_t, const void *,
+                          size_t ofs, size_t size);
+void cache_unhold (block_sector_t);
+void cache_rename (block_sector_t old, block_sector_t new);
+void cache_discard (block_sector_t);
+void cache_readahead (block_sector_t);
+void cache_flush (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,169 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the result of recent name lookups, so that looking
+   up the same name in the same directory again need not read
+   the directory.  A name that was not found is remembered too,
+   as a negative entry.  The cache holds at most DCACHE_SIZE
+   entries and discards the least recently used one when full. */
+
+/* Maximum number of cached entries. */
+#define DCACHE_SIZE 128
+
+/* A cached name lookup. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t inode_sector;        /* Result, or DCACHE_NEGATIVE. */
+  };
+
+static struct hash dentries;            /* All entries, by DIR and NAME. */
+static struct list lru_list;            /* Most recently used first. */
+static struct lock dcache_lock;         /* Protects the cache. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+static struct dentry *dentry_find (block_sector_t dir, const char *name);
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("directory entry cache creation failed");
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   If the result is cached, stores the sector of NAME's inode,
+   or DCACHE_NEGATIVE if NAME does not exist, in *INODE_SECTOR
+   and returns true.  Otherwise, returns false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *inode_sector)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+      *inode_sector = d->inode_sector;
+    }
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   DIR has its inode in INODE_SECTOR, or does not exist if
+   INODE_SECTOR is DCACHE_NEGATIVE. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               block_sector_t inode_sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else
+    {
+      if (hash_size (&dentries) >= DCACHE_SIZE)
+        {
+          /* Reuse the least recently used entry. */
+          d = list_entry (list_pop_back (&lru_list), struct dentry, lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+        }
+      else
+        {
+          d = malloc (sizeof *d);
+          if (d == NULL)
+            {
+              lock_release (&dcache_lock);
+              return;
+            }
+        }
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->inode_sector = inode_sector;
+  list_push_front (&lru_list, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets any cached lookup of NAME in the directory whose inode
+   is in sector DIR. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    {
+      hash_delete (&dentries, &d->hash_elem);
+      list_remove (&d->lru_elem);
+      free (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there
+   is none.  dcache_lock must be held. */
+static struct dentry *
+dentry_find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Returns a hash value for the entry that E is embedded in. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if entry A precedes entry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
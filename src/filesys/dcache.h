@@ -0,0 +1,17 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Inode sector recorded for a negative entry, that is, a name
+   known not to exist.  No directory entry ever refers to sector
+   0, which holds the free map's inode. */
+#define DCACHE_NEGATIVE ((block_sector_t) 0)
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name, block_sector_t *);
+void dcache_insert (block_sector_t dir, const char *name, block_sector_t);
+void dcache_invalidate (block_sector_t dir, const char *name);
+
+#endif /* filesys/dcache.h */
@@ -1,9 +1,12 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /* A directory. */
@@ -11,6 +14,7 @@ struct dir
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    bool hashed;                        /* DIR_HASHED format? */
   };
 
 /* A single directory entry. */
@@ -21,12 +25,88 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* A DIR_LINEAR directory is a flat array of struct dir_entry, so
+   finding a name or a free slot reads the whole directory.
+
+   A DIR_HASHED directory spreads its entries over buckets by a
+   hash of their names, using linear hashing to double the number
+   of buckets one bucket at a time as the directory grows.  Block
+   0 of the directory holds a struct hdir_header.  Bucket B's
+   first block is block 1 + B, and further blocks for a full
+   bucket come from the overflow area that begins at block
+   HDIR_OVERFLOW_BASE.  Each block begins with the block number
+   of the next block in its bucket, or 0 for the last one,
+   followed by HDIR_BLOCK_ENTRIES entries.  Blocks that have never
+   been written are holes in the inode, which read as empty. */
+
+/* Identifies a DIR_HASHED directory.  No linear directory's first
+   entry refers to a sector this large. */
+#define HDIR_MAGIC 0x48444952
+
+/* Number of buckets in a new directory. */
+#define HDIR_MIN_BUCKETS 4
+
+/* Buckets are split until there are this many.  After that,
+   buckets only grow longer. */
+#define HDIR_MAX_BUCKETS 2048
+
+/* A bucket is split whenever there are more than this many
+   entries per bucket, on average. */
+#define HDIR_LOAD 16
+
+/* Number of entries in a block. */
+#define HDIR_BLOCK_ENTRIES \
+        ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) / sizeof (struct dir_entry))
+
+/* Block number of the first overflow block. */
+#define HDIR_OVERFLOW_BASE (1 + HDIR_MAX_BUCKETS)
+
+/* Block 0 of a DIR_HASHED directory. */
+struct hdir_header
+  {
+    unsigned magic;                     /* HDIR_MAGIC. */
+    uint32_t level;                     /* Times the buckets have doubled. */
+    uint32_t split;                     /* Next bucket to split. */
+    uint32_t entry_cnt;                 /* Number of entries in use. */
+    uint32_t overflow_cnt;              /* Number of overflow blocks. */
+  };
+
+static bool hdir_read_header (struct inode *, struct hdir_header *);
+static bool hdir_write_header (struct inode *, const struct hdir_header *);
+static bool hdir_lookup (const struct dir *, const char *name,
+                         struct dir_entry *, off_t *);
+static bool hdir_add (struct dir *, const char *name, block_sector_t);
+static bool hdir_readdir (struct dir *, char name[NAME_MAX + 1]);
+
+/* Creates a directory in the given SECTOR in the given FORMAT.
+   A DIR_LINEAR directory starts out with space for ENTRY_CNT
+   entries.  Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, enum dir_format format)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct hdir_header h;
+  struct inode *inode;
+  bool success;
+
+  if (format == DIR_LINEAR)
+    return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+
+  /* Only the header needs to be written.  The buckets are holes
+     until entries are added to them. */
+  if (!inode_create (sector, HDIR_OVERFLOW_BASE * BLOCK_SECTOR_SIZE))
+    return false;
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  inode_mark_metadata (inode);
+  h.magic = HDIR_MAGIC;
+  h.level = 0;
+  h.split = 0;
+  h.entry_cnt = 0;
+  h.overflow_cnt = 0;
+  success = hdir_write_header (inode, &h);
+  inode_close (inode);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -37,8 +117,13 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      unsigned magic;
+
+      inode_mark_metadata (inode);
       dir->inode = inode;
       dir->pos = 0;
+      dir->hashed = (inode_read_at (inode, &magic, sizeof magic, 0)
+                     == sizeof magic && magic == HDIR_MAGIC);
       return dir;
     }
   else
@@ -98,6 +183,9 @@ lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (dir->hashed)
+    return hdir_lookup (dir, name, ep, ofsp);
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -119,15 +207,31 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector;
+  block_sector_t inode_sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  /* Consult the directory entry cache before the directory.
+     The directory stays locked until the inode is open, so that
+     the entry cannot be removed, nor its inode freed, in the
+     meantime. */
+  inode_lock (dir->inode);
+  dir_sector = inode_get_inumber (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &inode_sector))
+    {
+      inode_sector = (lookup (dir, name, &e, NULL)
+                      ? e.inode_sector : DCACHE_NEGATIVE);
+      dcache_insert (dir_sector, name, inode_sector);
+    }
+
+  if (inode_sector != DCACHE_NEGATIVE)
+    *inode = inode_open (inode_sector);
   else
     *inode = NULL;
+  inode_unlock (dir->inode);
 
   return *inode != NULL;
 }
@@ -152,6 +256,14 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  journal_begin ();
+  inode_lock (dir->inode);
+  if (dir->hashed)
+    {
+      success = hdir_add (dir, name, inode_sector);
+      goto done;
+    }
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
@@ -175,6 +287,10 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
  done:
+  if (success)
+    dcache_invalidate (inode_get_inumber (dir->inode), name);
+  inode_unlock (dir->inode);
+  journal_end ();
   return success;
 }
 
@@ -192,6 +308,9 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  journal_begin ();
+  inode_lock (dir->inode);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -205,13 +324,25 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  if (dir->hashed)
+    {
+      struct hdir_header h;
+      if (hdir_read_header (dir->inode, &h))
+        {
+          h.entry_cnt--;
+          hdir_write_header (dir->inode, &h);
+        }
+    }
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  inode_unlock (dir->inode);
   inode_close (inode);
+  journal_end ();
   return success;
 }
 
@@ -222,15 +353,335 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
+
+  inode_lock (dir->inode);
+  if (dir->hashed)
+    success = hdir_readdir (dir, name);
+  else
+    while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+      {
+        dir->pos += sizeof e;
+        if (e.in_use)
+          {
+            strlcpy (name, e.name, NAME_MAX + 1);
+            success = true;
+            break;
+          } 
+      }
+  inode_unlock (dir->inode);
+  return success;
+}
+
+/* Reads the header of hashed directory INODE into *H.
+   Returns true if successful, false on failure. */
+static bool
+hdir_read_header (struct inode *inode, struct hdir_header *h)
+{
+  return (inode_read_at (inode, h, sizeof *h, 0) == sizeof *h
+          && h->magic == HDIR_MAGIC);
+}
+
+/* Writes H as the header of hashed directory INODE.
+   Returns true if successful, false on failure. */
+static bool
+hdir_write_header (struct inode *inode, const struct hdir_header *h)
+{
+  return inode_write_at (inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+/* Returns the number of buckets in the directory with header H. */
+static size_t
+hdir_bucket_cnt (const struct hdir_header *h)
+{
+  return (HDIR_MIN_BUCKETS << h->level) + h->split;
+}
+
+/* Returns the bucket that NAME belongs in, in the directory with
+   header H.  Buckets before the split pointer have already been
+   split, so they are addressed with one more bit of the hash. */
+static size_t
+hdir_bucket (const struct hdir_header *h, const char *name)
+{
+  unsigned hash = hash_string (name);
+  size_t bucket = hash % (HDIR_MIN_BUCKETS << h->level);
+
+  if (bucket < h->split)
+    bucket = hash % (HDIR_MIN_BUCKETS << (h->level + 1));
+  return bucket;
+}
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+/* Returns the byte offset of entry SLOT within block BLOCK. */
+static off_t
+hdir_entry_ofs (uint32_t block, size_t slot)
+{
+  return (block * BLOCK_SECTOR_SIZE + sizeof (uint32_t)
+          + slot * sizeof (struct dir_entry));
+}
+
+/* Returns the number of the block after BLOCK in its bucket, or 0
+   if BLOCK is the last one. */
+static uint32_t
+hdir_next_block (struct inode *inode, uint32_t block)
+{
+  uint32_t next;
+
+  if (inode_read_at (inode, &next, sizeof next, block * BLOCK_SECTOR_SIZE)
+      != sizeof next)
+    return 0;
+  return next;
+}
+
+/* Searches hashed directory DIR for NAME, reading only NAME's
+   bucket.  Works like lookup(). */
+static bool
+hdir_lookup (const struct dir *dir, const char *name,
+             struct dir_entry *ep, off_t *ofsp)
+{
+  struct hdir_header h;
+  uint32_t block;
+
+  if (!hdir_read_header (dir->inode, &h))
+    return false;
+
+  for (block = 1 + hdir_bucket (&h, name); block != 0;
+       block = hdir_next_block (dir->inode, block))
     {
-      dir->pos += sizeof e;
+      size_t slot;
+
+      for (slot = 0; slot < HDIR_BLOCK_ENTRIES; slot++)
+        {
+          struct dir_entry e;
+          off_t ofs = hdir_entry_ofs (block, slot);
+
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            return false;
+          if (e.in_use && !strcmp (name, e.name))
+            {
+              if (ep != NULL)
+                *ep = e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+        }
+    }
+  return false;
+}
+
+/* Writes E into a free slot in BUCKET of hashed directory INODE,
+   whose header is *H, adding an overflow block to the bucket if
+   it is full.  Updates *H but does not write it back.
+   Returns true if successful, false on failure. */
+static bool
+hdir_insert (struct inode *inode, struct hdir_header *h, size_t bucket,
+             const struct dir_entry *e)
+{
+  uint32_t block = 1 + bucket;
+  uint32_t next, zero;
+
+  for (;;)
+    {
+      size_t slot;
+
+      for (slot = 0; slot < HDIR_BLOCK_ENTRIES; slot++)
+        {
+          struct dir_entry old;
+          off_t ofs = hdir_entry_ofs (block, slot);
+
+          if (inode_read_at (inode, &old, sizeof old, ofs) != sizeof old)
+            return false;
+          if (!old.in_use)
+            return inode_write_at (inode, e, sizeof *e, ofs) == sizeof *e;
+        }
+
+      next = hdir_next_block (inode, block);
+      if (next == 0)
+        break;
+      block = next;
+    }
+
+  /* Every block in the bucket is full.  Chain on a new overflow
+     block, writing its last word first so that the directory
+     extends to the end of the block. */
+  next = HDIR_OVERFLOW_BASE + h->overflow_cnt;
+  zero = 0;
+  if (inode_write_at (inode, &zero, sizeof zero,
+                      (next + 1) * BLOCK_SECTOR_SIZE - sizeof zero)
+      != sizeof zero
+      || inode_write_at (inode, e, sizeof *e, hdir_entry_ofs (next, 0))
+         != sizeof *e)
+    return false;
+  if (inode_write_at (inode, &next, sizeof next, block * BLOCK_SECTOR_SIZE)
+      != sizeof next)
+    return false;
+  h->overflow_cnt++;
+  return true;
+}
+
+/* Visits each entry in use in BUCKET of hashed directory INODE,
+   whose header is *H, that hashes to a different bucket.  If
+   ERASE is false, copies the entry into that bucket, otherwise
+   erases it from BUCKET.  Returns true if successful, false on
+   failure. */
+static bool
+hdir_move_entries (struct inode *inode, struct hdir_header *h,
+                   size_t bucket, bool erase)
+{
+  uint32_t block;
+
+  for (block = 1 + bucket; block != 0; block = hdir_next_block (inode, block))
+    {
+      size_t slot;
+
+      for (slot = 0; slot < HDIR_BLOCK_ENTRIES; slot++)
+        {
+          struct dir_entry e;
+          off_t ofs = hdir_entry_ofs (block, slot);
+
+          if (inode_read_at (inode, &e, sizeof e, ofs) != sizeof e)
+            return false;
+          if (!e.in_use || hdir_bucket (h, e.name) == bucket)
+            continue;
+
+          if (!erase)
+            {
+              if (!hdir_insert (inode, h, hdir_bucket (h, e.name), &e))
+                return false;
+            }
+          else
+            {
+              e.in_use = false;
+              if (inode_write_at (inode, &e, sizeof e, ofs) != sizeof e)
+                return false;
+            }
+        }
+    }
+  return true;
+}
+
+/* Marks every entry in BUCKET of hashed directory INODE free. */
+static void
+hdir_clear_bucket (struct inode *inode, size_t bucket)
+{
+  uint32_t block;
+
+  for (block = 1 + bucket; block != 0; block = hdir_next_block (inode, block))
+    {
+      size_t slot;
+
+      for (slot = 0; slot < HDIR_BLOCK_ENTRIES; slot++)
+        {
+          struct dir_entry e;
+          off_t ofs = hdir_entry_ofs (block, slot);
+
+          if (inode_read_at (inode, &e, sizeof e, ofs) == sizeof e
+              && e.in_use)
+            {
+              e.in_use = false;
+              inode_write_at (inode, &e, sizeof e, ofs);
+            }
+        }
+    }
+}
+
+/* Splits the next bucket of hashed directory INODE, whose header
+   is *H, moving the entries that now hash elsewhere into a new
+   bucket at the end of the table.  Updates *H but does not write
+   it back.
+
+   Entries are copied into the new bucket before any are erased
+   from the old one.  Only copying can run out of disk space, and
+   if it does, the split is undone and every entry stays where
+   it was. */
+static void
+hdir_split (struct inode *inode, struct hdir_header *h)
+{
+  uint32_t level = h->level;
+  uint32_t split = h->split;
+  size_t new_bucket = hdir_bucket_cnt (h);
+
+  if (new_bucket >= HDIR_MAX_BUCKETS)
+    return;
+
+  if (++h->split == (uint32_t) HDIR_MIN_BUCKETS << h->level)
+    {
+      h->level++;
+      h->split = 0;
+    }
+
+  if (!hdir_move_entries (inode, h, split, false))
+    {
+      hdir_clear_bucket (inode, new_bucket);
+      h->level = level;
+      h->split = split;
+      return;
+    }
+  hdir_move_entries (inode, h, split, true);
+}
+
+/* Adds NAME to hashed directory DIR, with its inode in
+   INODE_SECTOR, then splits a bucket if the directory has grown
+   too full.  Works like dir_add(), which checks NAME. */
+static bool
+hdir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
+{
+  struct hdir_header h;
+  struct dir_entry e;
+
+  if (!hdir_read_header (dir->inode, &h)
+      || hdir_lookup (dir, name, NULL, NULL))
+    return false;
+
+  e.in_use = true;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  if (!hdir_insert (dir->inode, &h, hdir_bucket (&h, name), &e))
+    return false;
+  h.entry_cnt++;
+
+  if (h.entry_cnt > HDIR_LOAD * hdir_bucket_cnt (&h))
+    hdir_split (dir->inode, &h);
+  return hdir_write_header (dir->inode, &h);
+}
+
+/* Reads the next entry in hashed directory DIR.  Works like
+   dir_readdir().  DIR's position counts entry slots, first
+   through the buckets' first blocks and then through the
+   overflow blocks.  Entries moved by a split between calls may
+   be skipped or returned twice. */
+static bool
+hdir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  struct hdir_header h;
+  size_t bucket_cnt;
+
+  if (!hdir_read_header (dir->inode, &h))
+    return false;
+  bucket_cnt = hdir_bucket_cnt (&h);
+
+  for (;;)
+    {
+      size_t index = dir->pos / HDIR_BLOCK_ENTRIES;
+      size_t slot = dir->pos % HDIR_BLOCK_ENTRIES;
+      uint32_t block;
+      struct dir_entry e;
+
+      if (index < bucket_cnt)
+        block = 1 + index;
+      else if (index - bucket_cnt < h.overflow_cnt)
+        block = HDIR_OVERFLOW_BASE + (index - bucket_cnt);
+      else
+        return false;
+
+      if (inode_read_at (dir->inode, &e, sizeof e,
+                         hdir_entry_ofs (block, slot)) != sizeof e)
+        return false;
+      dir->pos++;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
-        } 
+        }
     }
-  return false;
 }
@@ -13,8 +13,15 @@
 
 struct inode;
 
+/* On-disk directory formats. */
+enum dir_format
+  {
+    DIR_LINEAR,                 /* Flat array of entries. */
+    DIR_HASHED                  /* Entries in name-hash buckets. */
+  };
+
 /* Opening and closing directories. */
-bool dir_create (block_sector_t sector, size_t entry_cnt);
+bool dir_create (block_sector_t sector, size_t entry_cnt, enum dir_format);
 struct dir *dir_open (struct inode *);
 struct dir *dir_open_root (void);
 struct dir *dir_reopen (struct dir *);
@@ -6,8 +6,14 @@
 #include "filesys/fdtable.h"
 #include "threads/thread.h"
 
+/* Bounds on the read-ahead window, in sectors.  The window
+   starts at RA_MIN_SECTORS when a file is first read
+   sequentially and doubles on every further sequential read. */
+#define RA_MIN_SECTORS 2
+#define RA_MAX_SECTORS 16
 
 static void flip_bit(unsigned long *, unsigned long);
+static void file_readahead (struct file *, off_t pos, off_t size);
 
 
 struct file*
@@ -223,6 +229,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -269,10 +278,73 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_readahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
 
+/* Reads SIZE bytes from FILE into BUFFER, starting at the file's
+   current position, like file_read().  Whole sectors that are
+   not in the buffer cache are read from disk straight into
+   BUFFER, so a large read, such as into a user buffer, neither
+   copies its data twice nor pushes other data out of the cache.
+   Advances FILE's position by the number of bytes read. */
+off_t
+file_read_direct (struct file *file, void *buffer, off_t size) 
+{
+  off_t bytes_read = inode_read_direct (file->inode, buffer, size, file->pos);
+  file_readahead (file, file->pos, bytes_read);
+  file->pos += bytes_read;
+  return bytes_read;
+}
+
+/* Reads from FILE into the CNT buffers in IOV, filling each in
+   turn, starting at the file's current position, like
+   file_read_direct().
+   Returns the number of bytes actually read,
+   which may be less than requested if end of file is reached.
+   Advances FILE's position by the number of bytes read. */
+off_t
+file_readv (struct file *file, const struct iovec *iov, size_t cnt) 
+{
+  off_t bytes_read = inode_readv_at (file->inode, iov, cnt, file->pos);
+  file_readahead (file, file->pos, bytes_read);
+  file->pos += bytes_read;
+  return bytes_read;
+}
+
+/* Updates FILE's read-ahead state after SIZE bytes were read
+   at POS.  A read that starts where the previous one ended
+   grows the read-ahead window and queues the sectors that
+   follow it for prefetching; any other read turns read-ahead
+   off until the access pattern is sequential again. */
+static void
+file_readahead (struct file *file, off_t pos, off_t size)
+{
+  off_t start, end;
+
+  if (pos != file->ra_next)
+    {
+      file->ra_next = pos + size;
+      file->ra_end = 0;
+      file->ra_window = 0;
+      return;
+    }
+
+  file->ra_next = pos + size;
+  file->ra_window = (file->ra_window == 0 ? RA_MIN_SECTORS
+                     : min (file->ra_window * 2, RA_MAX_SECTORS));
+
+  /* Only queue what earlier read-aheads did not cover. */
+  start = max (file->ra_next, file->ra_end);
+  end = file->ra_next + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (start < end)
+    {
+      inode_readahead (file->inode, end - start, start);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -286,10 +358,9 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
+   Writing past end of file extends the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -299,12 +370,25 @@ file_write (struct file *file, const void *buffer, off_t size)
   return bytes_written;
 }
 
+/* Writes the CNT buffers in IOV into FILE, one after another,
+   starting at the file's current position, as a single write.
+   Writing past end of file extends the file.
+   Returns the number of bytes actually written,
+   which may be less than requested if the disk is full.
+   Advances FILE's position by the number of bytes written. */
+off_t
+file_writev (struct file *file, const struct iovec *iov, size_t cnt) 
+{
+  off_t bytes_written = inode_writev_at (file->inode, iov, cnt, file->pos);
+  file->pos += bytes_written;
+  return bytes_written;
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
+   Writing past end of file extends the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
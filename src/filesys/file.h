@@ -3,8 +3,10 @@
 
 #include "filesys/off_t.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 struct inode;
+struct iovec;
 
 /* An open file. */
 struct file 
@@ -12,6 +14,11 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Sequential read detection, see file_read(). */
+    off_t ra_next;              /* Position a sequential read starts at. */
+    off_t ra_end;               /* End of the data already read ahead. */
+    int ra_window;              /* Read-ahead window in sectors, 0 if off. */
   };
 
 /* Opening and closing files. */
@@ -23,8 +30,11 @@ struct inode *file_get_inode (struct file *);
 /* Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
+off_t file_read_direct (struct file *, void *, off_t);
+off_t file_readv (struct file *, const struct iovec *, size_t cnt);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_writev (struct file *, const struct iovec *, size_t cnt);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
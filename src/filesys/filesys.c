@@ -2,40 +2,56 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
-static void do_format (void);
+/* If true, filesys_done() simulates a crash.  See filesys.h. */
+bool filesys_crash;
+
+static void do_format (enum dir_format);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If FORMAT is true, reformats the file system, creating its
+   root directory in the given DIR_FORMAT. */
 void
-filesys_init (bool format) 
+filesys_init (bool format, enum dir_format dir_format) 
 {
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dcache_init ();
+  journal_init (format);
   free_map_init ();
 
   if (format) 
-    do_format ();
+    do_format (dir_format);
 
   free_map_open ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
-   to disk. */
+   to disk.  If filesys_crash is true, the metadata is left in
+   the journal instead, as described for journal_crash(). */
 void
 filesys_done (void) 
 {
+  inode_assign_delayed ();
   free_map_close ();
+  if (filesys_crash)
+    journal_crash ();
+  else
+    journal_done ();
 }
 
 
@@ -47,14 +63,22 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+
+  /* Place the new inode near its directory. */
+  success = (dir != NULL
+             && free_map_allocate (1, inode_get_inumber (dir_get_inode (dir)),
+                                   &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -84,21 +108,30 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
 
-/* Formats the file system. */
+/* Formats the file system, with a root directory in the given
+   DIR_FORMAT. */
 static void
-do_format (void)
+do_format (enum dir_format dir_format)
 {
   printf ("Formatting file system...");
+  journal_begin ();
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, dir_format))
     PANIC ("root directory creation failed");
   free_map_close ();
+  journal_end ();
+  journal_commit ();
   printf ("done.\n");
 }
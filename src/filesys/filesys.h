@@ -2,16 +2,23 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include "filesys/directory.h"
 #include "filesys/off_t.h"
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* First sector of the journal. */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
 
-void filesys_init (bool format);
+/* If true, filesys_done() leaves the file system to be
+   recovered from the journal at the next mount.
+   Controlled by kernel command-line option "-crash". */
+extern bool filesys_crash;
+
+void filesys_init (bool format, enum dir_format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
@@ -1,12 +1,53 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects the free map. */
+
+/* The disk is divided into groups of GROUP_SECTORS sectors, and
+   each group is summarized by the free runs it holds.  A search
+   for a run of free sectors consults the summaries and only scans
+   the bitmap of a group known to contain such a run.
+
+   Groups are also the unit of locality: an allocation is made in
+   the group of a nearby sector given by the caller if possible,
+   spilling over into the following groups, so that an inode ends
+   up near its directory and its data near the inode. */
+#define GROUP_SECTORS 1024
+
+/* Summary of a group's free sectors. */
+struct group
+  {
+    uint16_t free_cnt;               /* Number of free sectors. */
+    uint16_t longest;                /* Longest run of free sectors. */
+    uint16_t head;                   /* Free sectors at the start. */
+    uint16_t tail;                   /* Free sectors at the end. */
+  };
+
+static struct group *groups;         /* Summary of each group. */
+static size_t group_cnt;             /* Number of groups. */
+static size_t free_total;            /* Free sectors in all groups. */
+
+/* Free sectors promised by free_map_reserve() to data that has
+   not been given sectors yet.  Other allocations leave at least
+   this many sectors free. */
+static size_t reserved;
+
+static bool allocate (size_t cnt, block_sector_t near, bool reserved_ok,
+                      block_sector_t *);
+static size_t extend (block_sector_t, size_t cnt, bool reserved_ok);
+static void summarize (block_sector_t, size_t cnt);
+static size_t find_run (size_t cnt, size_t first_group);
+static bool persist (block_sector_t, size_t cnt);
 
 /* Initializes the free map. */
 void
@@ -17,36 +58,268 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  lock_init (&free_map_lock);
+
+  free_total = reserved = 0;
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  groups = calloc (group_cnt, sizeof *groups);
+  if (groups == NULL)
+    PANIC ("free map summary creation failed");
+  summarize (0, bitmap_size (free_map));
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Allocates CNT consecutive sectors from the free map, as close
+   to sector NEAR as possible, and stores the first into
+   *SECTORP.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
    written. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate (size_t cnt, block_sector_t near, block_sector_t *sectorp)
+{
+  return allocate (cnt, near, false, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the CNT sectors out of
+   those set aside by free_map_reserve(), in the same step, so
+   that no other allocation can get to them first.  The caller
+   must have reserved at least CNT sectors. */
+bool
+free_map_allocate_reserved (size_t cnt, block_sector_t near,
+                            block_sector_t *sectorp)
+{
+  return allocate (cnt, near, true, sectorp);
+}
+
+/* Allocates up to CNT consecutive sectors starting exactly at
+   SECTOR, so that a run of sectors ending just before SECTOR can
+   grow in place.
+   Returns the number of sectors allocated, which is 0 if SECTOR
+   is in use or if the free_map file could not be written. */
+size_t
+free_map_extend (block_sector_t sector, size_t cnt)
+{
+  return extend (sector, cnt, false);
+}
+
+/* Like free_map_extend(), but takes the sectors out of those set
+   aside by free_map_reserve(), as free_map_allocate_reserved()
+   does.  The caller must have reserved at least CNT sectors. */
+size_t
+free_map_extend_reserved (block_sector_t sector, size_t cnt)
+{
+  return extend (sector, cnt, true);
+}
+
+/* Allocates CNT consecutive sectors near NEAR and stores the
+   first into *SECTORP, as described for free_map_allocate().  If
+   RESERVED_OK is true, the sectors count against the reservation,
+   otherwise they must leave the reserved sectors free. */
+static bool
+allocate (size_t cnt, block_sector_t near, bool reserved_ok,
+          block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  ASSERT (!reserved_ok || reserved >= cnt);
+  if ((reserved_ok ? free_total : free_total - reserved) < cnt)
+    sector = BITMAP_ERROR;
+  else
+    sector = find_run (cnt, near < bitmap_size (free_map)
+                            ? near / GROUP_SECTORS : 0);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      summarize (sector, cnt);
+      if (!persist (sector, cnt))
+        {
+          bitmap_set_multiple (free_map, sector, cnt, false); 
+          summarize (sector, cnt);
+          sector = BITMAP_ERROR;
+        }
+      else if (reserved_ok)
+        reserved -= cnt;
     }
+  lock_release (&free_map_lock);
+  journal_end ();
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates up to CNT sectors starting at SECTOR, as described
+   for free_map_extend(), and returns the number allocated.
+   RESERVED_OK is as for allocate(). */
+static size_t
+extend (block_sector_t sector, size_t cnt, bool reserved_ok)
+{
+  size_t size = bitmap_size (free_map);
+  size_t n = 0;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  ASSERT (!reserved_ok || reserved >= cnt);
+  if (!reserved_ok && cnt > free_total - reserved)
+    cnt = free_total - reserved;
+  while (n < cnt && sector + n < size
+         && !bitmap_test (free_map, sector + n))
+    n++;
+  if (n > 0)
+    {
+      bitmap_set_multiple (free_map, sector, n, true);
+      summarize (sector, n);
+      if (!persist (sector, n))
+        {
+          bitmap_set_multiple (free_map, sector, n, false);
+          summarize (sector, n);
+          n = 0;
+        }
+      else if (reserved_ok)
+        reserved -= n;
+    }
+  lock_release (&free_map_lock);
+  journal_end ();
+  return n;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  journal_begin ();
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  summarize (sector, cnt);
+  persist (sector, cnt);
+  journal_revoke (sector, cnt);
+  lock_release (&free_map_lock);
+  journal_end ();
+}
+
+/* Sets aside CNT free sectors for data whose sectors will be
+   allocated later, so that the allocation cannot fail for lack
+   of space.  Returns true if successful, false if fewer than CNT
+   sectors are free and not already reserved. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_total - reserved >= cnt;
+  if (success)
+    reserved += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors reserved with free_map_reserve() that
+   are no longer needed. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved >= cnt);
+  reserved -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Recomputes the summary of every group that holds any of the
+   CNT sectors starting at SECTOR. */
+static void
+summarize (block_sector_t sector, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t g;
+
+  if (cnt == 0)
+    return;
+  for (g = sector / GROUP_SECTORS; g <= (sector + cnt - 1) / GROUP_SECTORS;
+       g++)
+    {
+      struct group *grp = &groups[g];
+      size_t start = g * GROUP_SECTORS;
+      size_t end = start + GROUP_SECTORS < size ? start + GROUP_SECTORS : size;
+      size_t run = 0;
+      size_t i;
+
+      free_total -= grp->free_cnt;
+      grp->free_cnt = grp->longest = grp->head = 0;
+      for (i = start; i < end; i++)
+        if (!bitmap_test (free_map, i))
+          {
+            grp->free_cnt++;
+            if (++run > grp->longest)
+              grp->longest = run;
+            if (run == i - start + 1)
+              grp->head = run;
+          }
+        else
+          run = 0;
+      grp->tail = run;
+      free_total += grp->free_cnt;
+    }
+}
+
+/* Returns the number of sectors in group G. */
+static size_t
+group_size (size_t g)
+{
+  size_t size = bitmap_size (free_map);
+  return (g + 1) * GROUP_SECTORS <= size ? GROUP_SECTORS : size % GROUP_SECTORS;
+}
+
+/* Returns the first sector of a run of CNT free sectors, or
+   BITMAP_ERROR if there is none.  Tries group FIRST_GROUP first,
+   then the groups after it, wrapping around to the start of the
+   disk.  A run that fits in one group is found by scanning only
+   that group.  A longer run starts in the free tail of one group,
+   crosses zero or more entirely free groups, and ends in the free
+   head of another. */
+static size_t
+find_run (size_t cnt, size_t first_group)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  ASSERT (first_group < group_cnt);
+
+  if (cnt == 0)
+    return BITMAP_ERROR;
+  for (i = 0; i < group_cnt; i++)
+    {
+      size_t g = (first_group + i) % group_cnt;
+      const struct group *grp = &groups[g];
+      size_t run, h;
+
+      if (grp->longest >= cnt)
+        return bitmap_scan (free_map, g * GROUP_SECTORS, cnt, false);
+
+      run = grp->tail;
+      for (h = g + 1; run > 0 && run < cnt && h < group_cnt; h++)
+        {
+          run += groups[h].head;
+          if (groups[h].free_cnt != group_size (h))
+            break;
+        }
+      if (run >= cnt)
+        return g * GROUP_SECTORS + group_size (g) - grp->tail;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Writes the part of the free map that holds the CNT sectors
+   starting at SECTOR to the free map file.  Returns true if
+   successful or if the file is not open yet, false on failure. */
+static bool
+persist (block_sector_t sector, size_t cnt)
+{
+  return (free_map_file == NULL
+          || bitmap_write_partial (free_map, free_map_file, sector, cnt));
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,8 +329,10 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_mark_metadata (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  summarize (0, bitmap_size (free_map));
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -72,14 +347,23 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The first write allocates the file's
+     blocks, which must not try to write the free map file while
+     it is still empty, so free_map_file is only set afterward.
+     The second write records the blocks just allocated. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  inode_mark_metadata (file_get_inode (file));
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
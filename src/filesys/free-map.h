@@ -11,7 +11,13 @@ void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
 
-bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate (size_t, block_sector_t near, block_sector_t *);
+bool free_map_allocate_reserved (size_t, block_sector_t near,
+                                 block_sector_t *);
+size_t free_map_extend (block_sector_t, size_t);
+size_t free_map_extend_reserved (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
 
 #endif /* filesys/free-map.h */
@@ -1,23 +1,61 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
+#include <list.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of LENGTH data blocks of a file, starting at block
+   OFFSET within the file, stored in consecutive sectors starting
+   at START. */
+struct extent
+  {
+    uint16_t offset;                    /* First block within the file. */
+    uint16_t length;                    /* Number of blocks. */
+    block_sector_t start;               /* Sector of the first block. */
+  };
+
+/* Extents kept in the inode itself. */
+#define INLINE_EXTENT_CNT 61
+
+/* Extents per overflow extent block, and overflow extent blocks
+   per extent index block. */
+#define EXTENTS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+#define EXTENT_BLOCK_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Most extents an inode can have. */
+#define INODE_MAX_EXTENTS (INLINE_EXTENT_CNT \
+                           + EXTENT_BLOCK_CNT * EXTENTS_PER_SECTOR)
+
+/* Largest number of data blocks a file can have. */
+#define INODE_MAX_SECTORS UINT16_MAX
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's data blocks are described by a list of extents,
+   sorted by OFFSET, that never overlap.  The first
+   INLINE_EXTENT_CNT extents are kept in the inode.  The rest are
+   kept in overflow extent blocks, which are listed in the extent
+   index block.  Blocks not covered by an extent have not been
+   written yet and read as zeros. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    block_sector_t extent_index;        /* Extent index block, or 0. */
+    struct extent extents[INLINE_EXTENT_CNT]; /* First extents. */
+    uint32_t unused[2];                 /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,47 +66,657 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* Delayed allocation.
+
+   A block written to a hole in an ordinary file is not given a
+   sector right away.  Instead, DELAYED_RESERVE free sectors are
+   reserved for it, and it is kept in the buffer cache under a made-up sector
+   number from CACHE_DELAYED_BASE up.  Later, when the file's
+   delayed blocks are written back, each run of consecutive
+   blocks is given sectors all at once, as one extent if
+   possible, and the cache entries are renamed to the real
+   sectors.  So a file appended to in small pieces costs one
+   allocation per run instead of one per write, and ends up
+   contiguous.
+
+   Delayed blocks are given sectors when a file has DELAYED_MAX
+   of them, when the last opener closes it, every time the
+   flusher thread runs, and before anything else allocates blocks
+   for the file.  No more than DELAYED_MAX blocks are delayed in
+   all, so that they never fill up the cache. */
+#define DELAYED_MAX (CACHE_SIZE / 4)
+
+/* Sectors reserved for each delayed block: one for the block,
+   and two for the extent blocks that giving it a sector may
+   take, since each new extent may need a new overflow extent
+   block, and the first one an extent index block too. */
+#define DELAYED_RESERVE 3
+
+/* A data block of a file that has not been given a sector. */
+struct delayed_block
+  {
+    size_t block;                       /* Block within the file. */
+    block_sector_t sector;              /* Its name in the cache. */
+  };
+
+/* In-memory inode.
+
+   OPEN_CNT, REMOVED, LOADING, FAILED and DELAYED_ELEM are
+   protected by open_inodes_lock.  The rest of the inode is protected by
+   RWLOCK: reading the file takes it for reading, and anything
+   that changes the length, the extents or the delayed blocks
+   takes it for writing.
+
+   Changes to the on-disk inode and its extent blocks always go
+   through the journal.  So does the data of a METADATA inode,
+   such as a directory or the free map. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool loading;                       /* Still being read in? */
+    bool failed;                        /* Reading in failed? */
+    struct rwlock rwlock;               /* Protects the members below. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    bool metadata;                      /* Journal writes to the data? */
     struct inode_disk data;             /* Inode content. */
+    struct extent *overflow;            /* Extents past the inline ones,
+                                           in whole extent blocks. */
+    size_t overflow_cap;                /* Extents OVERFLOW has room for. */
+    struct delayed_block delayed[DELAYED_MAX]; /* Delayed blocks,
+                                           sorted by BLOCK. */
+    size_t delayed_cnt;                 /* Number of DELAYED. */
+    size_t reserved;                    /* Sectors reserved for DELAYED. */
+    struct list_elem delayed_elem;      /* Element in delayed_inodes. */
+    bool on_delayed_list;               /* In delayed_inodes? */
+    struct lock lock;                   /* See inode_lock(). */
   };
 
+/* Returns INODE's extent number IDX. */
+static struct extent *
+extent_at (const struct inode *inode, size_t idx)
+{
+  ASSERT (idx < inode->data.extent_cnt);
+  if (idx < INLINE_EXTENT_CNT)
+    return (struct extent *) &inode->data.extents[idx];
+  else
+    return &inode->overflow[idx - INLINE_EXTENT_CNT];
+}
+
+/* Returns the index of INODE's last extent whose OFFSET is at
+   most BLOCK, or -1 if there is none, by binary search. */
+static int
+find_extent (const struct inode *inode, size_t block)
+{
+  int lo = 0;
+  int hi = (int) inode->data.extent_cnt - 1;
+
+  while (lo <= hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (extent_at (inode, mid)->offset <= block)
+        lo = mid + 1;
+      else
+        hi = mid - 1;
+    }
+  return hi;
+}
+
+/* Returns the sector that holds file block BLOCK of INODE,
+   according to its extents, or 0 if there is none. */
+static block_sector_t
+block_to_sector (const struct inode *inode, size_t block)
+{
+  int idx = find_extent (inode, block);
+
+  if (idx >= 0)
+    {
+      const struct extent *e = extent_at (inode, idx);
+      if (block < (size_t) e->offset + e->length)
+        return e->start + (block - e->offset);
+    }
+  return 0;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, which is a delayed block's made-up sector if
+   POS lies in a delayed block.
+   Returns 0 if no block has been allocated for POS. */
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) 
 {
+  size_t block = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t sector;
+  size_t i;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  ASSERT (pos >= 0);
+
+  sector = block_to_sector (inode, block);
+  if (sector != 0)
+    return sector;
+  for (i = 0; i < inode->delayed_cnt; i++)
+    if (inode->delayed[i].block == block)
+      return inode->delayed[i].sector;
+  return 0;
+}
+
+/* Reads INODE's overflow extents into memory.
+   Returns true if successful, false if out of memory. */
+static bool
+load_extents (struct inode *inode)
+{
+  size_t cnt = inode->data.extent_cnt;
+  size_t i;
+
+  inode->overflow = NULL;
+  inode->overflow_cap = 0;
+  if (cnt <= INLINE_EXTENT_CNT)
+    return true;
+
+  inode->overflow_cap = ROUND_UP (cnt - INLINE_EXTENT_CNT,
+                                  EXTENTS_PER_SECTOR);
+  inode->overflow = malloc (inode->overflow_cap * sizeof (struct extent));
+  if (inode->overflow == NULL)
+    return false;
+  for (i = 0; i < inode->overflow_cap / EXTENTS_PER_SECTOR; i++)
+    {
+      block_sector_t sector;
+
+      cache_read_at (inode->data.extent_index, &sector,
+                     i * sizeof sector, sizeof sector);
+      cache_read (sector, &inode->overflow[i * EXTENTS_PER_SECTOR]);
+    }
+  return true;
+}
+
+/* Allocates CNT consecutive sectors for INODE, as close to
+   sector NEAR as possible, and stores the first into *SECTORP.
+   While INODE's delayed blocks are being given sectors, takes
+   them out of the sectors reserved for those blocks.  Returns
+   true if successful, false if the disk is full. */
+static bool
+allocate_sectors (struct inode *inode, size_t cnt, block_sector_t near,
+                  block_sector_t *sectorp)
+{
+  if (inode->reserved < cnt)
+    return free_map_allocate (cnt, near, sectorp);
+  if (!free_map_allocate_reserved (cnt, near, sectorp))
+    return false;
+  inode->reserved -= cnt;
+  return true;
+}
+
+/* Allocates up to CNT sectors for INODE starting exactly at
+   SECTOR, the same way, and returns the number allocated. */
+static size_t
+extend_sectors (struct inode *inode, block_sector_t sector, size_t cnt)
+{
+  size_t n;
+
+  if (inode->reserved == 0)
+    return free_map_extend (sector, cnt);
+  if (cnt > inode->reserved)
+    cnt = inode->reserved;
+  n = free_map_extend_reserved (sector, cnt);
+  inode->reserved -= n;
+  return n;
+}
+
+/* Writes INODE's extents numbered FIRST and up to disk, along
+   with the inode itself.  Allocates overflow extent blocks as
+   needed.  Returns true if successful, false if the disk is
+   full. */
+static bool
+save_extents (struct inode *inode, size_t first)
+{
+  struct inode_disk *data = &inode->data;
+  size_t i;
+
+  if (data->extent_cnt > INLINE_EXTENT_CNT)
+    {
+      static char zeros[BLOCK_SECTOR_SIZE];
+
+      if (first < INLINE_EXTENT_CNT)
+        first = INLINE_EXTENT_CNT;
+      if (data->extent_index == 0)
+        {
+          if (!allocate_sectors (inode, 1, inode->sector,
+                                 &data->extent_index))
+            return false;
+          journal_write (data->extent_index, zeros);
+        }
+
+      for (i = (first - INLINE_EXTENT_CNT) / EXTENTS_PER_SECTOR;
+           i * EXTENTS_PER_SECTOR < data->extent_cnt - INLINE_EXTENT_CNT;
+           i++)
+        {
+          block_sector_t sector;
+          size_t ofs = i * sizeof sector;
+
+          cache_read_at (data->extent_index, &sector, ofs, sizeof sector);
+          if (sector == 0)
+            {
+              if (!allocate_sectors (inode, 1, inode->sector, &sector))
+                return false;
+              journal_write_at (data->extent_index, &sector, ofs,
+                                sizeof sector);
+            }
+          journal_write (sector, &inode->overflow[i * EXTENTS_PER_SECTOR]);
+        }
+    }
+  journal_write (inode->sector, data);
+  return true;
+}
+
+/* Inserts a new extent for the LENGTH blocks starting at file
+   block OFFSET, stored at sectors START onward, into INODE as
+   extent number IDX.  Returns true if successful, false if
+   INODE has too many extents or memory or disk allocation
+   fails. */
+static bool
+insert_extent (struct inode *inode, size_t idx, size_t offset,
+               block_sector_t start, size_t length)
+{
+  struct inode_disk *data = &inode->data;
+  struct extent *e;
+  size_t i;
+
+  if (data->extent_cnt >= INODE_MAX_EXTENTS)
+    return false;
+
+  /* Make room in the overflow array, a whole extent block at a
+     time, so that save_extents() can write it out directly. */
+  if (data->extent_cnt >= INLINE_EXTENT_CNT
+      && data->extent_cnt - INLINE_EXTENT_CNT >= inode->overflow_cap)
+    {
+      size_t cap = inode->overflow_cap + EXTENTS_PER_SECTOR;
+      struct extent *overflow = realloc (inode->overflow,
+                                         cap * sizeof *overflow);
+      if (overflow == NULL)
+        return false;
+      memset (overflow + inode->overflow_cap, 0,
+              EXTENTS_PER_SECTOR * sizeof *overflow);
+      inode->overflow = overflow;
+      inode->overflow_cap = cap;
+    }
+
+  data->extent_cnt++;
+  for (i = data->extent_cnt - 1; i > idx; i--)
+    *extent_at (inode, i) = *extent_at (inode, i - 1);
+  e = extent_at (inode, idx);
+  e->offset = offset;
+  e->length = length;
+  e->start = start;
+
+  if (!save_extents (inode, idx))
+    {
+      for (i = idx; i + 1 < data->extent_cnt; i++)
+        *extent_at (inode, i) = *extent_at (inode, i + 1);
+      data->extent_cnt--;
+      return false;
+    }
+  return true;
+}
+
+/* Writes SIZE bytes from BUFFER into data sector SECTOR of
+   INODE, starting at byte OFS within the sector, through the
+   journal if INODE holds metadata. */
+static void
+write_data (const struct inode *inode, block_sector_t sector,
+            const void *buffer, size_t ofs, size_t size)
+{
+  if (inode->metadata)
+    journal_write_at (sector, buffer, ofs, size);
   else
-    return -1;
+    cache_write_at (sector, buffer, ofs, size);
+}
+
+/* Fills with zeros the blocks among the CNT newly allocated
+   blocks of INODE, starting at file block BLOCK and sector
+   START, that a write of SIZE bytes at OFFSET only partly
+   covers.  Blocks the write covers completely need no
+   zeroing. */
+static void
+zero_partial_blocks (const struct inode *inode, size_t block,
+                     block_sector_t start, size_t cnt,
+                     off_t offset, off_t size)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t first = offset / BLOCK_SECTOR_SIZE;
+  size_t last = (offset + size - 1) / BLOCK_SECTOR_SIZE;
+
+  if (offset % BLOCK_SECTOR_SIZE != 0 && first >= block && first < block + cnt)
+    write_data (inode, start + (first - block), zeros, 0, BLOCK_SECTOR_SIZE);
+  if ((offset + size) % BLOCK_SECTOR_SIZE != 0 && last != first
+      && last >= block && last < block + cnt)
+    write_data (inode, start + (last - block), zeros, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Allocates blocks for the parts of the SIZE bytes at OFFSET
+   within INODE that have none yet.  Each run of missing blocks
+   is first allocated by extending the extent before it in place,
+   then from runs elsewhere on the disk that are as long as
+   possible, so that files stay contiguous as they grow.
+   Stops early if the disk is full. */
+static void
+allocate_blocks (struct inode *inode, off_t offset, off_t size)
+{
+  size_t block = offset / BLOCK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors (offset + size);
+
+  if (size <= 0)
+    return;
+  if (end > INODE_MAX_SECTORS)
+    end = INODE_MAX_SECTORS;
+  while (block < end)
+    {
+      int idx = find_extent (inode, block);
+      struct extent *e = idx >= 0 ? extent_at (inode, idx) : NULL;
+      size_t run = end - block;
+      block_sector_t start, near;
+      size_t cnt;
+
+      /* Skip blocks that are already allocated. */
+      if (e != NULL && block < (size_t) e->offset + e->length)
+        {
+          block = e->offset + e->length;
+          continue;
+        }
+
+      /* The missing run ends at the next extent, if any. */
+      if ((size_t) idx + 1 < inode->data.extent_cnt)
+        {
+          size_t next = extent_at (inode, idx + 1)->offset;
+          if (next - block < run)
+            run = next - block;
+        }
+
+      /* Extend the previous extent in place if it ends right
+         before BLOCK. */
+      if (e != NULL && (size_t) e->offset + e->length == block)
+        {
+          if (run > (size_t) UINT16_MAX - e->length)
+            run = UINT16_MAX - e->length;
+          start = e->start + e->length;
+          cnt = run > 0 ? extend_sectors (inode, start, run) : 0;
+          if (cnt > 0)
+            {
+              zero_partial_blocks (inode, block, start, cnt, offset, size);
+              e->length += cnt;
+              if (!save_extents (inode, idx))
+                {
+                  e->length -= cnt;
+                  free_map_release (start, cnt);
+                  return;
+                }
+              block += cnt;
+              continue;
+            }
+        }
+
+      /* Otherwise allocate the longest run we can get, near the
+         end of the previous extent, or near the inode if there is
+         none. */
+      near = e != NULL ? e->start + e->length : inode->sector;
+      for (cnt = run; cnt > 0; cnt /= 2)
+        if (allocate_sectors (inode, cnt, near, &start))
+          break;
+      if (cnt == 0)
+        return;
+      zero_partial_blocks (inode, block, start, cnt, offset, size);
+      if (!insert_extent (inode, idx + 1, block, start, cnt))
+        {
+          free_map_release (start, cnt);
+          return;
+        }
+      block += cnt;
+    }
+}
+
+/* Returns true if every block of the SIZE bytes at OFFSET within
+   INODE has been allocated. */
+static bool
+is_allocated (const struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    if (byte_to_sector (inode, offset) == 0)
+      return false;
+  return true;
+}
+
+/* Releases every data block of INODE and the blocks holding its
+   overflow extents. */
+static void
+release_blocks (struct inode *inode)
+{
+  struct inode_disk *data = &inode->data;
+  size_t i;
+
+  for (i = 0; i < data->extent_cnt; i++)
+    {
+      struct extent *e = extent_at (inode, i);
+      free_map_release (e->start, e->length);
+    }
+
+  if (data->extent_index != 0)
+    {
+      for (i = 0; i < EXTENT_BLOCK_CNT; i++)
+        {
+          block_sector_t sector;
+
+          cache_read_at (data->extent_index, &sector, i * sizeof sector,
+                         sizeof sector);
+          if (sector != 0)
+            free_map_release (sector, 1);
+        }
+      free_map_release (data->extent_index, 1);
+    }
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of open inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt of every open inode. */
+static struct lock open_inodes_lock;
+
+/* Signaled when an inode in open_inodes has been read in. */
+static struct condition inode_loaded;
+
+/* Open inodes that have delayed blocks, the number of delayed
+   blocks in all, and the made-up sector of the next delayed
+   block.  Protected by open_inodes_lock. */
+static struct list delayed_inodes;
+static size_t delayed_total;
+static block_sector_t next_delayed;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table creation failed");
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
+  list_init (&delayed_inodes);
+  delayed_total = 0;
+  next_delayed = CACHE_DELAYED_BASE;
+}
+
+/* Returns a hash value for the inode that E is embedded in. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Gives INODE's delayed blocks sectors, each run of consecutive
+   blocks all at once, and moves their data in the cache to those
+   sectors.  The sectors, and any extent blocks they need, come
+   out of those reserved for the blocks, so the disk filling up
+   meanwhile cannot leave a block without one.  Only if INODE
+   runs out of extents, or memory for them, is a block left
+   without a sector, and then it is dropped and reads as zeros.
+   INODE's rwlock must be held for writing, inside a journal
+   operation. */
+static void
+assign_delayed (struct inode *inode)
+{
+  struct delayed_block *d = inode->delayed;
+  size_t cnt = inode->delayed_cnt;
+  size_t i, j;
+
+  if (cnt == 0)
+    return;
+
+  inode->delayed_cnt = 0;
+  for (i = 0; i < cnt; i = j)
+    {
+      for (j = i + 1; j < cnt && d[j].block == d[j - 1].block + 1; j++)
+        continue;
+      allocate_blocks (inode, d[i].block * BLOCK_SECTOR_SIZE,
+                       (j - i) * BLOCK_SECTOR_SIZE);
+    }
+  for (i = 0; i < cnt; i++)
+    {
+      block_sector_t sector = block_to_sector (inode, d[i].block);
+      if (sector != 0)
+        cache_rename (d[i].sector, sector);
+      else
+        cache_discard (d[i].sector);
+    }
+  free_map_unreserve (inode->reserved);
+  inode->reserved = 0;
+
+  lock_acquire (&open_inodes_lock);
+  delayed_total -= cnt;
+  if (inode->on_delayed_list)
+    {
+      list_remove (&inode->delayed_elem);
+      inode->on_delayed_list = false;
+    }
+  lock_release (&open_inodes_lock);
+}
+
+/* Gives each block of the SIZE bytes at OFFSET within INODE that
+   has no sector yet a delayed block, filled with zeros.  Returns
+   true if successful, false if too many blocks are delayed
+   already or the disk is full, in which case the caller must
+   allocate the remaining blocks itself.  INODE's rwlock must be
+   held for writing, inside a journal operation. */
+static bool
+delay_blocks (struct inode *inode, off_t offset, off_t size)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t block = offset / BLOCK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors (offset + size);
+
+  if (end > INODE_MAX_SECTORS)
+    end = INODE_MAX_SECTORS;
+  for (; block < end; block++)
+    {
+      block_sector_t sector = 0;
+      bool ok;
+      size_t i;
+
+      if (byte_to_sector (inode, block * BLOCK_SECTOR_SIZE) != 0)
+        continue;
+      if (inode->delayed_cnt >= DELAYED_MAX)
+        assign_delayed (inode);
+      if (!free_map_reserve (DELAYED_RESERVE))
+        return false;
+
+      lock_acquire (&open_inodes_lock);
+      ok = delayed_total < DELAYED_MAX;
+      if (ok)
+        {
+          delayed_total++;
+          sector = next_delayed++;
+          if (next_delayed == (block_sector_t) -1)
+            next_delayed = CACHE_DELAYED_BASE;
+          if (!inode->on_delayed_list)
+            {
+              list_push_back (&delayed_inodes, &inode->delayed_elem);
+              inode->on_delayed_list = true;
+            }
+        }
+      lock_release (&open_inodes_lock);
+      if (!ok)
+        {
+          free_map_unreserve (DELAYED_RESERVE);
+          return false;
+        }
+      inode->reserved += DELAYED_RESERVE;
+
+      cache_write (sector, zeros);
+      for (i = inode->delayed_cnt; i > 0 && inode->delayed[i - 1].block > block;
+           i--)
+        inode->delayed[i] = inode->delayed[i - 1];
+      inode->delayed[i].block = block;
+      inode->delayed[i].sector = sector;
+      inode->delayed_cnt++;
+    }
+  return true;
+}
+
+/* Gives the delayed blocks of every open inode sectors. */
+void
+inode_assign_delayed (void)
+{
+  size_t i;
+
+  /* Every inode on the list has a delayed block, so there are
+     never more than DELAYED_MAX of them.  Stopping after that
+     many keeps a busy writer from holding us here forever. */
+  for (i = 0; i < DELAYED_MAX; i++)
+    {
+      struct inode *inode = NULL;
+
+      lock_acquire (&open_inodes_lock);
+      if (!list_empty (&delayed_inodes))
+        {
+          inode = list_entry (list_front (&delayed_inodes),
+                              struct inode, delayed_elem);
+          inode->open_cnt++;
+        }
+      lock_release (&open_inodes_lock);
+      if (inode == NULL)
+        break;
+
+      journal_begin ();
+      rwlock_acquire_write (&inode->rwlock);
+      assign_delayed (inode);
+      rwlock_release_write (&inode->rwlock);
+      journal_end ();
+      inode_close (inode);
+    }
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  No data blocks are allocated: the data reads as
+   zeros until it is written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is larger
+   than the largest possible file. */
 bool
 inode_create (block_sector_t sector, off_t length)
 {
@@ -81,25 +729,18 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (bytes_to_sectors (length) > INODE_MAX_SECTORS)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      journal_begin ();
+      journal_write (sector, disk_inode);
+      journal_end ();
+      success = true; 
       free (disk_inode);
     }
   return success;
@@ -107,37 +748,89 @@ inode_create (block_sector_t sector, off_t length)
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+
+   The inode is added to open_inodes, marked as loading, before
+   it is read in, and the table is unlocked during the read, so
+   that opening one inode does not hold up opening or closing any
+   other.  Anyone else who opens the same inode meanwhile waits
+   for the read to finish. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
+  bool success, last = false;
+
+  lock_acquire (&open_inodes_lock);
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode_loaded, &open_inodes_lock);
+      if (inode->failed)
         {
-          inode_reopen (inode);
-          return inode; 
+          last = --inode->open_cnt == 0;
+          lock_release (&open_inodes_lock);
+          if (last)
+            free (inode);
+          return NULL;
         }
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
+  inode->metadata = false;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loading = true;
+  inode->failed = false;
+  inode->delayed_cnt = 0;
+  inode->reserved = 0;
+  inode->on_delayed_list = false;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->lock);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  /* Read it in. */
+  cache_read (inode->sector, &inode->data);
+  success = load_extents (inode);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  if (!success)
+    {
+      hash_delete (&open_inodes, &inode->elem);
+      inode->failed = true;
+      last = --inode->open_cnt == 0;
+    }
+  cond_broadcast (&inode_loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
+
+  if (!success)
+    {
+      if (last)
+        free (inode);
+      return NULL;
+    }
   return inode;
 }
 
@@ -146,7 +839,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,24 +860,59 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  /* Give delayed blocks sectors before the last opener lets go,
+     while nobody else can open the inode from disk. */
+  for (;;)
+    {
+      lock_acquire (&open_inodes_lock);
+      if (inode->open_cnt > 1 || inode->removed || inode->delayed_cnt == 0)
+        break;
+      lock_release (&open_inodes_lock);
+
+      journal_begin ();
+      rwlock_acquire_write (&inode->rwlock);
+      assign_delayed (inode);
+      rwlock_release_write (&inode->rwlock);
+      journal_end ();
+    }
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  last = --inode->open_cnt == 0;
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
+      hash_delete (&open_inodes, &inode->elem);
+      if (inode->on_delayed_list)
+        list_remove (&inode->delayed_elem);
+      delayed_total -= inode->delayed_cnt;
+    }
+  lock_release (&open_inodes_lock);
+
+  if (last)
+    {
+      size_t i;
+
+      /* Drop the delayed blocks of a removed inode. */
+      for (i = 0; i < inode->delayed_cnt; i++)
+        cache_discard (inode->delayed[i].sector);
+      if (inode->reserved > 0)
+        free_map_unreserve (inode->reserved);
+
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          journal_begin ();
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_blocks (inode);
+          journal_end ();
         }
 
+      free (inode->overflow);
       free (inode); 
     }
 }
@@ -191,132 +923,286 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+/* Marks INODE as holding file system metadata, so that writes to
+   its data go through the journal. */
+void
+inode_mark_metadata (struct inode *inode)
+{
+  ASSERT (inode != NULL);
+  inode->metadata = true;
+}
+
+/* Acquires INODE's lock.  The inode layer does not use this lock
+   itself.  The directory layer holds it while it searches or
+   changes a directory, so that operations on one directory are
+   serialized without holding up any other file. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/* Releases INODE's lock, acquired with inode_lock(). */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
+}
+
+/* Most sectors read_at() reads straight from disk at once. */
+#define DIRECT_MAX_SECTORS 128
+
+/* Reads from INODE into the CNT buffers in IOV, in order,
+   starting at position OFFSET, holding INODE's lock for reading
+   throughout.  If DIRECT is true, runs of whole sectors that are
+   consecutive on disk and not cached are read straight into the
+   buffers, each run with a single request, see
+   cache_read_direct().  Returns the number of bytes actually
+   read. */
+static off_t
+read_at (struct inode *inode, const struct iovec *iov, size_t cnt,
+         off_t offset, bool direct)
 {
-  uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  size_t i;
 
-  while (size > 0) 
+  rwlock_acquire_read (&inode->rwlock);
+  for (i = 0; i < cnt; i++)
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      uint8_t *buffer = iov[i].iov_base;
+      off_t size = iov[i].iov_len;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+      while (size > 0) 
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
+          /* Disk sector to read, starting byte offset within sector. */
+          block_sector_t sector_idx = byte_to_sector (inode, offset);
+          int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+
+          /* Bytes left in inode, bytes left in sector, lesser of the two. */
+          off_t inode_left = inode_length (inode) - offset;
+          int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+          int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+          /* Number of bytes to actually copy out of this sector. */
+          int chunk_size = size < min_left ? size : min_left;
+          if (chunk_size <= 0)
+            goto done;
+
+          /* Extend a direct read of a whole sector over the whole
+             sectors that follow it on disk. */
+          if (sector_idx != 0 && direct && chunk_size == BLOCK_SECTOR_SIZE)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              size_t cnt = 1;
+
+              while (size - chunk_size >= BLOCK_SECTOR_SIZE
+                     && inode_left - chunk_size >= BLOCK_SECTOR_SIZE
+                     && cnt < DIRECT_MAX_SECTORS
+                     && (byte_to_sector (inode, offset + chunk_size)
+                         == sector_idx + cnt))
+                {
+                  chunk_size += BLOCK_SECTOR_SIZE;
+                  cnt++;
+                }
+              cache_read_direct (sector_idx, cnt, buffer);
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+
+          /* Otherwise copy the chunk out of the buffer cache.  Holes
+             read as zeros. */
+          else if (sector_idx != 0)
+            cache_read_at (sector_idx, buffer, sector_ofs, chunk_size);
+          else
+            memset (buffer, 0, chunk_size);
+
+          /* Advance. */
+          size -= chunk_size;
+          offset += chunk_size;
+          buffer += chunk_size;
+          bytes_read += chunk_size;
         }
-      
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_read += chunk_size;
     }
-  free (bounce);
+ done:
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  struct iovec iov;
+
+  iov.iov_base = buffer;
+  iov.iov_len = size;
+  return read_at (inode, &iov, 1, offset, false);
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, like inode_read_at(), except that whole sectors that
+   are not in the buffer cache are read from disk straight into
+   BUFFER instead of through the cache. */
+off_t
+inode_read_direct (struct inode *inode, void *buffer, off_t size,
+                   off_t offset)
+{
+  struct iovec iov;
+
+  iov.iov_base = buffer;
+  iov.iov_len = size;
+  return read_at (inode, &iov, 1, offset, true);
+}
+
+/* Reads from INODE into the CNT buffers in IOV, one after
+   another, starting at position OFFSET, in a single pass, like
+   inode_read_direct().  Returns the number of bytes actually
+   read, which may be less than the buffers' total size if end
+   of file is reached. */
+off_t
+inode_readv_at (struct inode *inode, const struct iovec *iov, size_t cnt,
+                off_t offset)
+{
+  return read_at (inode, iov, cnt, offset, true);
+}
+
+/* Writes the CNT buffers in IOV, one after another, into INODE,
+   starting at OFFSET.
+   Writing past end of file extends the inode.  Blocks are
+   provided for the whole write up front, so that they can be
+   allocated contiguously: delayed blocks for an ordinary file,
+   real ones for metadata or if too many blocks are delayed.
+   A write that neither extends INODE nor fills in a hole leaves
+   INODE's metadata alone, so it runs alongside readers and other
+   such writes.  The buffer cache keeps each sector consistent.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than the buffers' total size if the disk is full or the
+   file would become larger than the largest possible file. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+inode_writev_at (struct inode *inode, const struct iovec *iov, size_t cnt,
+                 off_t offset) 
 {
-  const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t size = 0;
+  bool exclusive;
+  size_t i;
 
-  if (inode->deny_write_cnt)
+  for (i = 0; i < cnt; i++)
+    size += iov[i].iov_len;
+
+  /* Writing nothing must not extend the file, even past EOF. */
+  if (size == 0)
     return 0;
 
-  while (size > 0) 
+  journal_begin ();
+  rwlock_acquire_read (&inode->rwlock);
+  exclusive = (offset + size > inode->data.length
+               || !is_allocated (inode, offset, size));
+  if (exclusive)
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      rwlock_release_read (&inode->rwlock);
+      rwlock_acquire_write (&inode->rwlock);
+    }
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
+  if (inode->deny_write_cnt)
+    goto done;
+
+  if (exclusive && (inode->metadata || !delay_blocks (inode, offset, size)))
+    {
+      assign_delayed (inode);
+      allocate_blocks (inode, offset, size);
+    }
+  for (i = 0; i < cnt; i++)
+    {
+      const uint8_t *buffer = iov[i].iov_base;
+      size = iov[i].iov_len;
+
+      while (size > 0) 
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+          /* Sector to write, starting byte offset within sector. */
+          block_sector_t sector_idx = byte_to_sector (inode, offset);
+          int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          /* Bytes left in sector. */
+          int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+
+          /* Number of bytes to actually write into this sector. */
+          int chunk_size = size < sector_left ? size : sector_left;
+          if (sector_idx == 0)
+            goto extend;
+
+          /* Copy the chunk into the buffer cache, which reads in the
+             rest of the sector first if the chunk is partial. */
+          write_data (inode, sector_idx, buffer, sector_ofs, chunk_size);
+
+          /* Advance. */
+          size -= chunk_size;
+          offset += chunk_size;
+          buffer += chunk_size;
+          bytes_written += chunk_size;
         }
+    }
 
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_written += chunk_size;
+ extend:
+  /* Extend the file to cover what was written. */
+  if (offset > inode->data.length)
+    {
+      ASSERT (exclusive);
+      inode->data.length = offset;
+      journal_write (inode->sector, &inode->data);
     }
-  free (bounce);
 
+ done:
+  if (exclusive)
+    rwlock_release_write (&inode->rwlock);
+  else
+    rwlock_release_read (&inode->rwlock);
+  journal_end ();
   return bytes_written;
 }
 
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   as described for inode_writev_at().
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk is full or the file would become
+   larger than the largest possible file. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+                off_t offset) 
+{
+  struct iovec iov;
+
+  iov.iov_base = (void *) buffer;
+  iov.iov_len = size;
+  return inode_writev_at (inode, &iov, 1, offset);
+}
+
+/* Queues the sectors holding the SIZE bytes of INODE starting
+   at OFFSET for asynchronous read-ahead into the buffer cache.
+   Bytes past the end of INODE are ignored. */
+void
+inode_readahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        cache_readahead (sector);
+    }
+  rwlock_release_read (&inode->rwlock);
+}
+
 /* 
  * Is this inode writable
  */
@@ -329,8 +1215,10 @@ inode_can_write(struct inode *inode) {
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -339,9 +1227,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
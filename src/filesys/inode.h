@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <uio.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
@@ -14,8 +15,18 @@ struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_mark_metadata (struct inode *);
+void inode_lock (struct inode *);
+void inode_unlock (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+off_t inode_read_direct (struct inode *, void *, off_t size, off_t offset);
+off_t inode_readv_at (struct inode *, const struct iovec *, size_t cnt,
+                      off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_writev_at (struct inode *, const struct iovec *, size_t cnt,
+                       off_t offset);
+void inode_readahead (struct inode *, off_t size, off_t offset);
+void inode_assign_delayed (void);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
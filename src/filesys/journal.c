@@ -0,0 +1,559 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead metadata journal.
+
+   Every change to file system metadata (inodes, extent blocks,
+   directories and the free map) is made inside a transaction
+   bracketed by journal_begin() and journal_end(), and written
+   with journal_write_at().  The changed sectors are held in the
+   buffer cache, so that they cannot reach their home locations
+   on disk before they have been logged.
+
+   Transactions are committed in groups: all the changes made by
+   every thread since the last commit are logged together, by
+   the commit thread every COMMIT_INTERVAL ticks, or sooner if
+   the running transaction grows large.  A commit writes a
+   descriptor naming the changed sectors, a copy of each sector,
+   and finally a commit record, one after another into the log.
+   Afterward the sectors are released to be written back to their
+   home locations as usual.
+
+   The log occupies the JOURNAL_SECTORS sectors starting at
+   JOURNAL_SECTOR.  The first is a header that gives the sequence
+   number of the first transaction in the log, and the rest hold
+   transactions, in order, from the start.  When the log is
+   nearly full, every dirty sector is written home, and the log
+   is emptied by advancing the header's sequence number past
+   every transaction in it.
+
+   At mount time, each transaction in the log with a commit
+   record and the expected sequence number is copied to its home
+   locations.  A transaction without a commit record was
+   interrupted, and it and everything after it are ignored.  So
+   recovery reads at most the log, never the whole disk.
+
+   A sector that is freed while a copy of it is in the log, say a
+   directory block of a deleted directory, may be reused for file
+   data, which is not logged.  Replaying the stale copy would
+   then overwrite the data.  So freeing such a sector adds a
+   revoke record for it to the running transaction's commit
+   record, and replay skips every copy of the sector logged in
+   that transaction or earlier.  Logging the sector again later
+   in the same transaction cancels the revoke. */
+
+/* Identifies journal sectors. */
+#define HEADER_MAGIC 0x4a524e4c         /* Journal header. */
+#define DESC_MAGIC 0x4a444553           /* Transaction descriptor. */
+#define COMMIT_MAGIC 0x4a434d54         /* Commit record. */
+
+/* Most sectors a transaction can change.  Every one of them is
+   held in the buffer cache until the commit, and so may be up to
+   DELAYED_MAX (a quarter of the cache) delayed blocks, so this
+   leaves a quarter of the cache for everything else.  Otherwise
+   an operation could wait in the cache for a sector to evict,
+   while the commit that would free one waits for the operation
+   to end. */
+#define TXN_MAX_SECTORS (CACHE_SIZE / 2)
+
+/* Sectors set aside for each operation between journal_begin()
+   and journal_end().  A new operation waits for a commit if the
+   running transaction does not have this many left over for
+   every operation in progress.  An operation that changes more
+   sectors than this, such as removing a large file, is split:
+   what it has done so far is ended as an operation of its own,
+   and the rest begins again as a new one, which may wait for a
+   commit. */
+#define OP_MAX_SECTORS 16
+
+/* Sectors of the log area, after the header. */
+#define LOG_SECTORS (JOURNAL_SECTORS - 1)
+
+/* Interval between group commits, in timer ticks. */
+#define COMMIT_INTERVAL (TIMER_FREQ / 2)
+
+/* Journal header, in sector JOURNAL_SECTOR. */
+struct journal_header
+  {
+    unsigned magic;                     /* HEADER_MAGIC. */
+    uint32_t seq;                       /* Sequence number of first
+                                           transaction in the log. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 2 * sizeof (uint32_t)];
+  };
+
+/* First sector of a logged transaction.  It is followed by CNT
+   sectors of data, then by a commit record. */
+struct journal_desc
+  {
+    unsigned magic;                     /* DESC_MAGIC. */
+    uint32_t seq;                       /* Sequence number. */
+    uint32_t cnt;                       /* Number of sectors. */
+    block_sector_t sectors[TXN_MAX_SECTORS]; /* Home of each sector. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)
+                   - TXN_MAX_SECTORS * sizeof (block_sector_t)];
+  };
+
+/* Most revoke records a commit record can hold.  Only a sector
+   that is in the log or in the running transaction is revoked,
+   and there are never more of those than the log's LOG_SECTORS - 2
+   data sectors, so this is always enough. */
+#define TXN_MAX_REVOKES (BLOCK_SECTOR_SIZE / sizeof (uint32_t) - 3)
+
+/* Last sector of a logged transaction. */
+struct journal_commit
+  {
+    unsigned magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Sequence number. */
+    uint32_t revoke_cnt;                /* Number of revoke records. */
+    block_sector_t revokes[TXN_MAX_REVOKES]; /* Sectors revoked. */
+  };
+
+static struct lock journal_lock;        /* Protects the members below. */
+static struct condition journal_idle;   /* Signaled when ACTIVE drops to 0. */
+static struct condition journal_ready;  /* Signaled when a commit ends. */
+static int active;                      /* Operations in progress. */
+static bool committing;                 /* Commit in progress? */
+static uint32_t txn_seq;                /* Running transaction's number. */
+static block_sector_t txn_sectors[TXN_MAX_SECTORS]; /* Its sectors. */
+static size_t txn_cnt;                  /* Number of TXN_SECTORS. */
+static block_sector_t txn_revokes[TXN_MAX_REVOKES]; /* Its revokes. */
+static size_t revoke_cnt;               /* Number of TXN_REVOKES. */
+static size_t log_used;                 /* Log sectors in use. */
+static block_sector_t logged[LOG_SECTORS]; /* Sectors with a copy in
+                                           the log. */
+static size_t logged_cnt;               /* Number of LOGGED. */
+
+static void reserve (void);
+static void release (void);
+static void commit (void);
+static void reset_log (void);
+static void replay (uint32_t seq);
+static thread_func commit_thread NO_RETURN;
+
+/* Initializes the journal.  If FORMAT is true, creates an empty
+   journal, otherwise recovers the file system from the journal
+   on disk. */
+void
+journal_init (bool format)
+{
+  lock_init (&journal_lock);
+  cond_init (&journal_idle);
+  cond_init (&journal_ready);
+  active = 0;
+  committing = false;
+  txn_cnt = 0;
+  revoke_cnt = 0;
+  log_used = 0;
+  logged_cnt = 0;
+
+  if (format)
+    txn_seq = 1;
+  else
+    {
+      struct journal_header h;
+
+      block_read (fs_device, JOURNAL_SECTOR, &h);
+      if (h.magic != HEADER_MAGIC)
+        PANIC ("file system has no journal, reformat with -f");
+      replay (h.seq);
+    }
+  reset_log ();
+
+  thread_create ("journal", PRI_DEFAULT, commit_thread, NULL);
+}
+
+/* Begins an operation that changes metadata.  The operation's
+   changes become part of the running transaction, which is not
+   committed until journal_end() is called.  Calls may nest, in
+   which case only the outermost pair counts. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  reserve ();
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation begun with journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  release ();
+  lock_release (&journal_lock);
+}
+
+/* Waits until the running transaction has OP_MAX_SECTORS
+   sectors to spare for a new operation by the running thread,
+   committing it if necessary, and then starts the operation.
+   journal_lock must be held. */
+static void
+reserve (void)
+{
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  while (committing
+         || txn_cnt + (active + 1) * OP_MAX_SECTORS > TXN_MAX_SECTORS)
+    if (!committing)
+      commit ();
+    else
+      cond_wait (&journal_ready, &journal_lock);
+  active++;
+  thread_current ()->journal_cnt = 0;
+}
+
+/* Ends the running thread's operation.  journal_lock must be
+   held. */
+static void
+release (void)
+{
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (active > 0);
+
+  if (--active == 0)
+    cond_signal (&journal_idle, &journal_lock);
+}
+
+/* Writes SIZE bytes from BUFFER to metadata sector SECTOR,
+   starting at byte OFS within the sector, as part of the running
+   transaction.  Must be called between journal_begin() and
+   journal_end().  If the operation has already changed
+   OP_MAX_SECTORS other sectors, it is split, as described above
+   OP_MAX_SECTORS. */
+void
+journal_write_at (block_sector_t sector, const void *buffer,
+                  size_t ofs, size_t size)
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  ASSERT (t->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < revoke_cnt; i++)
+    if (txn_revokes[i] == sector)
+      {
+        txn_revokes[i] = txn_revokes[--revoke_cnt];
+        break;
+      }
+  for (i = 0; i < txn_cnt; i++)
+    if (txn_sectors[i] == sector)
+      break;
+  if (i == txn_cnt)
+    {
+      if (t->journal_cnt >= OP_MAX_SECTORS)
+        {
+          release ();
+          reserve ();
+        }
+
+      /* reserve() set aside room for every operation in
+         progress, and none has used more than its share. */
+      ASSERT (txn_cnt < TXN_MAX_SECTORS);
+      txn_sectors[txn_cnt++] = sector;
+      t->journal_cnt++;
+    }
+  lock_release (&journal_lock);
+
+  cache_hold_write_at (sector, buffer, ofs, size);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to metadata sector
+   SECTOR as part of the running transaction. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Adds SECTOR to the running transaction's revoke records, if it
+   is not there already.  journal_lock must be held. */
+static void
+add_revoke (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  for (i = 0; i < revoke_cnt; i++)
+    if (txn_revokes[i] == sector)
+      return;
+  ASSERT (revoke_cnt < TXN_MAX_REVOKES);
+  txn_revokes[revoke_cnt++] = sector;
+}
+
+/* Records, as part of the running transaction, that the CNT
+   sectors starting at SECTOR are being freed, so that any copy
+   of them in the log is not replayed over whatever they are
+   reused for.  Must be called between journal_begin() and
+   journal_end(). */
+void
+journal_revoke (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < logged_cnt; )
+    if (logged[i] >= sector && logged[i] - sector < cnt)
+      {
+        /* Once revoked, the copies in the log are as good as
+           gone, until the sector is logged again. */
+        add_revoke (logged[i]);
+        logged[i] = logged[--logged_cnt];
+      }
+    else
+      i++;
+  for (i = 0; i < txn_cnt; i++)
+    if (txn_sectors[i] >= sector && txn_sectors[i] - sector < cnt)
+      add_revoke (txn_sectors[i]);
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction, waiting for the operations in
+   it to end first. */
+void
+journal_commit (void)
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_ready, &journal_lock);
+  commit ();
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction, writes every dirty sector
+   home, and empties the log, so that the next mount has nothing
+   to replay. */
+void
+journal_done (void)
+{
+  journal_commit ();
+  lock_acquire (&journal_lock);
+  cache_flush ();
+  reset_log ();
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction, then writes every dirty
+   sector home except those with a copy in the log, and drops
+   those from the cache.  This leaves the disk as it would be if
+   the machine lost power after the commit but before any of the
+   logged metadata got home, so that the next mount must recover
+   it from the log.  For testing recovery. */
+void
+journal_crash (void)
+{
+  size_t i;
+
+  journal_commit ();
+  lock_acquire (&journal_lock);
+  for (i = 0; i < logged_cnt; i++)
+    cache_discard (logged[i]);
+  cache_flush ();
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction.  journal_lock must be held,
+   and no commit may be in progress. */
+static void
+commit (void)
+{
+  static struct journal_desc desc;
+  static struct journal_commit rec;
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+  block_sector_t log;
+  size_t i, j;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (!committing);
+
+  /* Keep new operations out, and wait for those running to end,
+     so that the transaction is complete. */
+  committing = true;
+  while (active > 0)
+    cond_wait (&journal_idle, &journal_lock);
+
+  if (txn_cnt > 0 || revoke_cnt > 0)
+    {
+      /* There is always room for a whole transaction, because
+         the log is emptied below when there is not. */
+      ASSERT (log_used + txn_cnt + 2 <= LOG_SECTORS);
+      log = JOURNAL_SECTOR + 1 + log_used;
+
+      memset (&desc, 0, sizeof desc);
+      desc.magic = DESC_MAGIC;
+      desc.seq = txn_seq;
+      desc.cnt = txn_cnt;
+      memcpy (desc.sectors, txn_sectors, txn_cnt * sizeof *txn_sectors);
+      block_write (fs_device, log, &desc);
+      for (i = 0; i < txn_cnt; i++)
+        {
+          cache_read (txn_sectors[i], buffer);
+          block_write (fs_device, log + 1 + i, buffer);
+        }
+      memset (&rec, 0, sizeof rec);
+      rec.magic = COMMIT_MAGIC;
+      rec.seq = txn_seq;
+      rec.revoke_cnt = revoke_cnt;
+      memcpy (rec.revokes, txn_revokes, revoke_cnt * sizeof *txn_revokes);
+      block_write (fs_device, log + 1 + txn_cnt, &rec);
+
+      /* The transaction is durable.  Its sectors may go home. */
+      for (i = 0; i < txn_cnt; i++)
+        {
+          cache_unhold (txn_sectors[i]);
+          for (j = 0; j < logged_cnt; j++)
+            if (logged[j] == txn_sectors[i])
+              break;
+          if (j == logged_cnt)
+            logged[logged_cnt++] = txn_sectors[i];
+        }
+      log_used += txn_cnt + 2;
+      txn_seq++;
+      txn_cnt = 0;
+      revoke_cnt = 0;
+
+      if (log_used + TXN_MAX_SECTORS + 2 > LOG_SECTORS)
+        {
+          cache_flush ();
+          reset_log ();
+        }
+    }
+
+  committing = false;
+  cond_broadcast (&journal_ready, &journal_lock);
+}
+
+/* Empties the log by writing a header that points past every
+   transaction in it.  Every committed sector must already be
+   home. */
+static void
+reset_log (void)
+{
+  static struct journal_header h;
+
+  memset (&h, 0, sizeof h);
+  h.magic = HEADER_MAGIC;
+  h.seq = txn_seq;
+  block_write (fs_device, JOURNAL_SECTOR, &h);
+  log_used = 0;
+  logged_cnt = 0;
+}
+
+/* Reads the descriptor and commit record of the transaction at
+   position POS in the log into *DESC and *REC.  Returns true if
+   it is a committed transaction numbered SEQ, false if the log
+   ends before it. */
+static bool
+read_txn (size_t pos, uint32_t seq, struct journal_desc *desc,
+          struct journal_commit *rec)
+{
+  block_sector_t log = JOURNAL_SECTOR + 1 + pos;
+
+  if (pos + 2 > LOG_SECTORS)
+    return false;
+  block_read (fs_device, log, desc);
+  if (desc->magic != DESC_MAGIC || desc->seq != seq
+      || desc->cnt > TXN_MAX_SECTORS || pos + desc->cnt + 2 > LOG_SECTORS)
+    return false;
+  block_read (fs_device, log + 1 + desc->cnt, rec);
+  return (rec->magic == COMMIT_MAGIC && rec->seq == seq
+          && rec->revoke_cnt <= TXN_MAX_REVOKES);
+}
+
+/* Copies every committed transaction in the log, starting with
+   the one numbered SEQ, to its home locations, except the copies
+   of revoked sectors, and sets txn_seq to the number of the
+   first transaction not found. */
+static void
+replay (uint32_t seq)
+{
+  static struct journal_desc desc;
+  static struct journal_commit rec;
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+  static block_sector_t revoked[LOG_SECTORS]; /* Revoked sectors. */
+  static uint32_t revoked_seq[LOG_SECTORS];   /* Latest revoke of each. */
+  size_t revoked_cnt = 0;
+  uint32_t first = seq;
+  size_t pos;
+  size_t i, j;
+
+  /* Find the committed transactions and the last transaction to
+     revoke each sector. */
+  for (pos = 0; read_txn (pos, seq, &desc, &rec); pos += desc.cnt + 2)
+    {
+      for (i = 0; i < rec.revoke_cnt; i++)
+        {
+          for (j = 0; j < revoked_cnt; j++)
+            if (revoked[j] == rec.revokes[i])
+              break;
+          if (j == revoked_cnt)
+            {
+              if (revoked_cnt >= LOG_SECTORS)
+                continue;
+              revoked[revoked_cnt++] = rec.revokes[i];
+            }
+          revoked_seq[j] = seq;
+        }
+      seq++;
+    }
+  txn_seq = seq;
+
+  /* Copy them home, skipping each sector revoked by the same or
+     a later transaction. */
+  for (pos = 0, seq = first; seq < txn_seq; pos += desc.cnt + 2, seq++)
+    {
+      block_sector_t log = JOURNAL_SECTOR + 1 + pos;
+
+      read_txn (pos, seq, &desc, &rec);
+      for (i = 0; i < desc.cnt; i++)
+        {
+          for (j = 0; j < revoked_cnt; j++)
+            if (revoked[j] == desc.sectors[i])
+              break;
+          if (j < revoked_cnt && revoked_seq[j] >= seq)
+            continue;
+          block_read (fs_device, log + 1 + i, buffer);
+          block_write (fs_device, desc.sectors[i], buffer);
+        }
+    }
+
+  if (txn_seq != first)
+    printf ("journal: replayed %zu transactions\n",
+            (size_t) (txn_seq - first));
+}
+
+/* Commit thread.  Commits the running transaction every
+   COMMIT_INTERVAL ticks, so that many operations share each
+   commit. */
+static void
+commit_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_INTERVAL);
+      journal_commit ();
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Sectors reserved for the journal, starting at JOURNAL_SECTOR. */
+#define JOURNAL_SECTORS 128
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void journal_write (block_sector_t, const void *);
+void journal_revoke (block_sector_t, size_t cnt);
+void journal_commit (void);
+void journal_done (void);
+void journal_crash (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,39 @@
+#ifndef __LIB_BLKSTAT_H
+#define __LIB_BLKSTAT_H
+
+#include <stdint.h>
+
+/* Request directions, for indexing the arrays below. */
+#define BLKSTAT_READ 0
+#define BLKSTAT_WRITE 1
+
+/* Number of latency buckets.  Bucket I counts requests that took
+   at least 2**I and less than 2**(I+1) CPU cycles, except that
+   bucket 0 also counts those that took less than 1. */
+#define BLKSTAT_BUCKETS 32
+
+/* Number of queue depth buckets.  Bucket I counts requests that
+   found I others in flight when they were submitted, except that
+   the last bucket also counts those that found more. */
+#define BLKSTAT_DEPTHS 16
+
+/* I/O statistics for one block device.  See blkstat(). */
+struct blkstat
+  {
+    char name[16];                      /* Device name, e.g. "hda1". */
+    uint64_t requests[2];               /* Requests, by direction. */
+    uint64_t bytes[2];                  /* Bytes moved, by direction. */
+    uint64_t sequential;                /* Requests that began where the
+                                           one before ended. */
+    uint64_t latency[2][BLKSTAT_BUCKETS]; /* Requests by direction and
+                                             log2 of cycles taken. */
+    uint64_t depth[BLKSTAT_DEPTHS];     /* Requests by depth at submission. */
+    uint32_t depth_max;                 /* Most requests ever in flight. */
+    uint64_t depth_cycles;              /* Requests in flight, summed over
+                                           every cycle: divided by CYCLES,
+                                           the mean queue depth. */
+    uint64_t busy_cycles;               /* Cycles with a request in flight. */
+    uint64_t cycles;                    /* Cycles since registration. */
+  };
+
+#endif /* lib/blkstat.h */
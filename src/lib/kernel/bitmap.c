@@ -291,20 +291,41 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+   Makes a single pass over B, counting the length of the current
+   run of VALUE bits and skipping whole elements that contain
+   none of them. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  elem_type skip = value ? 0 : (elem_type) -1;
+  size_t run = 0;
+  size_t i;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  if (cnt > b->bit_cnt)
+    return BITMAP_ERROR;
+
+  for (i = start; i < b->bit_cnt; )
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      if (i % ELEM_BITS == 0 && b->bits[elem_idx (i)] == skip)
+        {
+          run = 0;
+          i += ELEM_BITS;
+          continue;
+        }
+      if (bitmap_test (b, i) == value)
+        {
+          if (++run == cnt)
+            return i + 1 - cnt;
+        }
+      else
+        run = 0;
+      i++;
     }
   return BITMAP_ERROR;
 }
@@ -358,6 +379,26 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes to FILE only the part of B that holds the CNT bits
+   starting at START, in whole elements, at the same place in
+   FILE where bitmap_write() would put it.  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_partial (const struct bitmap *b, struct file *file,
+                      size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  ofs = elem_idx (start) * sizeof (elem_type);
+  size = (elem_idx (start + cnt - 1) + 1) * sizeof (elem_type) - ofs;
+  return file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
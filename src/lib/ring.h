@@ -0,0 +1,65 @@
+#ifndef __LIB_RING_H
+#define __LIB_RING_H
+
+#include <stdint.h>
+
+/* Submission and completion ring, for batching system calls.
+
+   A user program places a `struct ring' in its own memory and
+   registers it with ring_setup().  To issue requests, it fills
+   in entries of SQ starting at index SQ_TAIL, advances SQ_TAIL
+   past them, and calls ring_enter().  The kernel carries out the
+   requests in order, advancing SQ_HEAD past each one and posting
+   its result in CQ at index CQ_TAIL.  The program consumes
+   results starting at CQ_HEAD and advances CQ_HEAD past them.
+
+   The indexes count up forever; an index I refers to entry
+   I % RING_ENTRIES.  Each index is written only by its owner:
+   the program writes SQ_TAIL and CQ_HEAD, the kernel writes
+   SQ_HEAD and CQ_TAIL.  The kernel stops taking requests while
+   the completion queue is full. */
+
+/* Number of entries in each queue.  A power of 2. */
+#define RING_ENTRIES 64
+
+/* Request types. */
+enum ring_op
+  {
+    RING_OP_NOP,                /* Do nothing, result 0. */
+    RING_OP_READ,               /* read (FD, ADDR, LEN). */
+    RING_OP_WRITE,              /* write (FD, ADDR, LEN). */
+    RING_OP_SEEK,               /* seek (FD, LEN), result 0. */
+    RING_OP_OPEN,               /* open (ADDR). */
+    RING_OP_CLOSE               /* close (FD), result 0. */
+  };
+
+/* A request. */
+struct ring_sqe
+  {
+    uint32_t op;                /* One of RING_OP_*. */
+    int32_t fd;                 /* File descriptor. */
+    void *addr;                 /* Buffer or file name. */
+    uint32_t len;               /* Buffer length or file position. */
+    uint32_t user_data;         /* Copied into the completion. */
+  };
+
+/* A request's result. */
+struct ring_cqe
+  {
+    uint32_t user_data;         /* From the request. */
+    int32_t res;                /* Result, as from the system call,
+                                   or -1 if the request was bad. */
+  };
+
+/* The ring itself. */
+struct ring
+  {
+    uint32_t sq_head;           /* Next request the kernel takes. */
+    uint32_t sq_tail;           /* Next request the program adds. */
+    uint32_t cq_head;           /* Next result the program takes. */
+    uint32_t cq_tail;           /* Next result the kernel adds. */
+    struct ring_sqe sq[RING_ENTRIES]; /* Submission queue. */
+    struct ring_cqe cq[RING_ENTRIES]; /* Completion queue. */
+  };
+
+#endif /* lib/ring.h */
@@ -28,9 +28,22 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Vectored and positional I/O. */
+    SYS_READV,                  /* Read into several buffers. */
+    SYS_WRITEV,                 /* Write from several buffers. */
+    SYS_PREAD,                  /* Read at a given position. */
+    SYS_PWRITE,                 /* Write at a given position. */
+
+    /* Batched system calls. */
+    SYS_RING_SETUP,             /* Register a submission ring. */
+    SYS_RING_ENTER,             /* Carry out queued requests. */
+
+    /* Statistics. */
+    SYS_BLKSTAT                 /* Get block device statistics. */
   };
 
-#define SYS_NUM 27
+#define SYS_NUM 28
 
 #endif /* lib/syscall-nr.h */
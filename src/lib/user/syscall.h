@@ -3,6 +3,9 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <blkstat.h>
+#include <ring.h>
+#include <uio.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +48,17 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Vectored and positional I/O. */
+int readv (int fd, const struct iovec *, int iovcnt);
+int writev (int fd, const struct iovec *, int iovcnt);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+
+/* Batched system calls. */
+bool ring_setup (struct ring *);
+int ring_enter (unsigned to_submit);
+
+/* Statistics. */
+bool blkstat (unsigned idx, struct blkstat *);
+
 #endif /* lib/user/syscall.h */
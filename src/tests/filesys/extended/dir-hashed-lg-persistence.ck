@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($tree);
+for my $i (0...199) {
+    $tree->{big}{$i} = [''] if $i % 2;
+}
+check_archive ($tree);
+pass;
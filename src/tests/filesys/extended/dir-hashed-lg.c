@@ -0,0 +1,60 @@
+/* Creates many files in one directory, formatted as a hash table
+   by the -dirs=hashed kernel option, opens each of them, removes
+   every other one, and checks that exactly those are gone. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+
+void
+test_main (void) 
+{
+  char name[32];
+  int fd;
+  int i;
+
+  CHECK (mkdir ("big"), "mkdir \"big\"");
+
+  msg ("creating big/0 through big/%d...", FILE_CNT - 1);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "big/%d", i);
+      CHECK (create (name, 0), "create \"%s\"", name);
+    }
+  quiet = false;
+
+  msg ("opening each file...");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "big/%d", i);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      close (fd);
+    }
+  quiet = false;
+
+  msg ("removing even-numbered files...");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      snprintf (name, sizeof name, "big/%d", i);
+      CHECK (remove (name), "remove \"%s\"", name);
+    }
+  quiet = false;
+
+  msg ("checking each file...");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "big/%d", i);
+      fd = open (name);
+      if (i % 2 == 0 && fd != -1)
+        fail ("\"%s\" still exists after removal", name);
+      if (i % 2 != 0 && fd < 2)
+        fail ("open \"%s\" failed", name);
+      close (fd);
+    }
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hashed-lg) begin
+(dir-hashed-lg) mkdir "big"
+(dir-hashed-lg) creating big/0 through big/199...
+(dir-hashed-lg) opening each file...
+(dir-hashed-lg) removing even-numbered files...
+(dir-hashed-lg) checking each file...
+(dir-hashed-lg) end
+EOF
+pass;
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($tree);
+for my $b (0...1) {
+    for my $c (0...1) {
+	for my $d (0...3) {
+	    $tree->{0}{$b}{$c}{$d} = [''];
+	}
+    }
+}
+$tree->{data} = ["\x55" x 8192];
+$tree->{new}{$_} = [''] for 0...15;
+check_archive ($tree);
+pass;
@@ -0,0 +1,77 @@
+/* Creates directories /0/0/0 through /1/1/1 and files in the
+   leaf directories, removes /1 and everything in it, and then
+   creates a file with data and a new directory of files, which
+   may reuse the sectors just freed.  Run with the -crash kernel
+   option, which leaves all this metadata in the journal at
+   power off, so that the next mount must recover it, without
+   replaying stale copies of the freed directory blocks over the
+   new file's data. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/extended/mk-tree.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[8192];
+
+static void do_remove (const char *format, ...) PRINTF_FORMAT (1, 2);
+
+void
+test_main (void) 
+{
+  char name[32];
+  int fd;
+  int b, c, d;
+  int i;
+
+  make_tree (2, 2, 2, 4);
+
+  msg ("removing /1...");
+  quiet = true;
+  for (b = 0; b < 2; b++)
+    {
+      for (c = 0; c < 2; c++)
+        {
+          for (d = 0; d < 4; d++)
+            do_remove ("/1/%d/%d/%d", b, c, d);
+          do_remove ("/1/%d/%d", b, c);
+        }
+      do_remove ("/1/%d", b);
+    }
+  do_remove ("/1");
+  quiet = false;
+
+  memset (buf, 0x55, sizeof buf);
+  CHECK (create ("/data", 0), "create \"/data\"");
+  CHECK ((fd = open ("/data")) > 1, "open \"/data\"");
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"/data\"");
+  msg ("close \"/data\"");
+  close (fd);
+
+  CHECK (mkdir ("/new"), "mkdir \"/new\"");
+  msg ("creating /new/0 through /new/15...");
+  quiet = true;
+  for (i = 0; i < 16; i++)
+    {
+      snprintf (name, sizeof name, "/new/%d", i);
+      CHECK (create (name, 0), "create \"%s\"", name);
+    }
+  quiet = false;
+}
+
+static void
+do_remove (const char *format, ...) 
+{
+  char name[128];
+  va_list args;
+
+  va_start (args, format);
+  vsnprintf (name, sizeof name, format, args);
+  va_end (args);
+
+  CHECK (remove (name), "remove \"%s\"", name);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-recover) begin
+(journal-recover) creating /0/0/0/0 through /1/1/1/3...
+(journal-recover) open "/0/1/0/3"
+(journal-recover) close "/0/1/0/3"
+(journal-recover) removing /1...
+(journal-recover) create "/data"
+(journal-recover) open "/data"
+(journal-recover) write "/data"
+(journal-recover) close "/data"
+(journal-recover) mkdir "/new"
+(journal-recover) creating /new/0 through /new/15...
+(journal-recover) end
+EOF
+pass;
@@ -0,0 +1,27 @@
+/* Gets the statistics of every block device with blkstat() and
+   checks that each device has a name, that reads have been made,
+   as they must have been to load this program, and that asking
+   for a device past the last one fails. */
+
+#include <blkstat.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct blkstat stats;
+  uint64_t reads = 0;
+  unsigned idx;
+
+  CHECK (blkstat (0, &stats), "blkstat of first device");
+  for (idx = 0; blkstat (idx, &stats); idx++)
+    {
+      if (stats.name[0] == '\0')
+        fail ("device %u has no name", idx);
+      reads += stats.requests[BLKSTAT_READ];
+    }
+  CHECK (reads > 0, "devices have been read");
+  CHECK (!blkstat (idx, &stats), "blkstat past last device fails");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(blkstat-normal) begin
+(blkstat-normal) blkstat of first device
+(blkstat-normal) devices have been read
+(blkstat-normal) blkstat past last device fails
+(blkstat-normal) end
+blkstat-normal: exit(0)
+EOF
+pass;
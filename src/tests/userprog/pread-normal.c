@@ -0,0 +1,28 @@
+/* Reads part of "sample.txt" from the middle with pread() and
+   checks that the data is right and that the file position has
+   not moved. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[40];
+  int handle, byte_cnt;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  byte_cnt = pread (handle, buf, sizeof buf, 50);
+  if (byte_cnt != sizeof buf)
+    fail ("pread() returned %d instead of %zu", byte_cnt, sizeof buf);
+  compare_bytes (buf, sample + 50, sizeof buf, 50, "sample.txt");
+  CHECK (tell (handle) == 0, "file position unchanged");
+
+  /* A read past the end of the file reads nothing. */
+  byte_cnt = pread (handle, buf, sizeof buf, sizeof sample + 100);
+  if (byte_cnt != 0)
+    fail ("pread() past end of file returned %d instead of 0", byte_cnt);
+}
@@ -0,0 +1,21 @@
+/* Tries to pwrite() to invalid fds,
+   which must either fail silently or terminate the process with
+   exit code -1. */
+
+#include <limits.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf = 123;
+  pwrite (0x01012342, &buf, 1, 0);
+  pwrite (7, &buf, 1, 0);
+  pwrite (2546, &buf, 1, 0);
+  pwrite (-5, &buf, 1, 0);
+  pwrite (-8192, &buf, 1, 0);
+  pwrite (INT_MIN + 1, &buf, 1, 0);
+  pwrite (INT_MAX - 1, &buf, 1, 0);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF', <<'EOF']);
+(pwrite-bad-fd) begin
+(pwrite-bad-fd) end
+pwrite-bad-fd: exit(0)
+EOF
+(pwrite-bad-fd) begin
+pwrite-bad-fd: exit(-1)
+EOF
+pass;
@@ -0,0 +1,32 @@
+/* Reads "sample.txt" into two buffers with a single readv(),
+   splitting it partway through a line, and checks that together
+   they hold the whole file. */
+
+#include <syscall.h>
+#include <uio.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char head[10], tail[sizeof sample - 1 - 10];
+  struct iovec iov[2];
+  int handle, byte_cnt;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  iov[0].iov_base = head;
+  iov[0].iov_len = sizeof head;
+  iov[1].iov_base = tail;
+  iov[1].iov_len = sizeof tail;
+  byte_cnt = readv (handle, iov, 2);
+  if (byte_cnt != sizeof sample - 1)
+    fail ("readv() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+
+  compare_bytes (head, sample, sizeof head, 0, "sample.txt");
+  compare_bytes (tail, sample + sizeof head, sizeof tail, sizeof head,
+                 "sample.txt");
+  msg ("verified contents of \"sample.txt\"");
+}
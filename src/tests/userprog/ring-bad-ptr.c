@@ -0,0 +1,34 @@
+/* Passes invalid pointers to the submission ring.  Registering a
+   ring at a kernel address must fail, and so must ring_enter()
+   with no ring registered.  A request with a bad buffer must fail
+   with -1 without killing the process. */
+
+#include <ring.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct ring ring;
+
+void
+test_main (void) 
+{
+  struct ring_sqe *sqe;
+  int handle;
+
+  CHECK (!ring_setup ((struct ring *) 0xc0100000),
+         "ring_setup at kernel address fails");
+  CHECK (ring_enter (1) == -1, "ring_enter without a ring fails");
+
+  CHECK (ring_setup (&ring), "ring_setup");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  sqe = &ring.sq[ring.sq_tail % RING_ENTRIES];
+  sqe->op = RING_OP_READ;
+  sqe->fd = handle;
+  sqe->addr = (char *) 0xc0100000;
+  sqe->len = 123;
+  sqe->user_data = 1;
+  ring.sq_tail++;
+  CHECK (ring_enter (1) == 1, "submit read into kernel address");
+  CHECK (ring.cq[ring.cq_head % RING_ENTRIES].res == -1, "read fails");
+}
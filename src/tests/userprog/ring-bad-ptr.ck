@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ring-bad-ptr) begin
+(ring-bad-ptr) ring_setup at kernel address fails
+(ring-bad-ptr) ring_enter without a ring fails
+(ring-bad-ptr) ring_setup
+(ring-bad-ptr) open "sample.txt"
+(ring-bad-ptr) submit read into kernel address
+(ring-bad-ptr) read fails
+(ring-bad-ptr) end
+ring-bad-ptr: exit(0)
+EOF
+pass;
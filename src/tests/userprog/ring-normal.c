@@ -0,0 +1,75 @@
+/* Opens, reads, seeks in and closes "sample.txt" through the
+   submission ring, several requests per ring_enter(), and checks
+   each request's result. */
+
+#include <ring.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct ring ring;
+
+/* Queues a request in RING. */
+static void
+submit (enum ring_op op, int fd, void *addr, uint32_t len,
+        uint32_t user_data)
+{
+  struct ring_sqe *sqe = &ring.sq[ring.sq_tail % RING_ENTRIES];
+
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->addr = addr;
+  sqe->len = len;
+  sqe->user_data = user_data;
+  ring.sq_tail++;
+}
+
+/* Takes the next result from RING and checks that it belongs to
+   the request tagged USER_DATA.  Returns its result. */
+static int
+complete (uint32_t user_data)
+{
+  struct ring_cqe *cqe;
+
+  if (ring.cq_head == ring.cq_tail)
+    fail ("no result for request %u", user_data);
+  cqe = &ring.cq[ring.cq_head++ % RING_ENTRIES];
+  if (cqe->user_data != user_data)
+    fail ("result for request %u instead of %u", cqe->user_data, user_data);
+  return cqe->res;
+}
+
+void
+test_main (void) 
+{
+  char buf[sizeof sample - 1], buf2[10];
+  int handle, result;
+
+  CHECK (ring_setup (&ring), "ring_setup");
+
+  submit (RING_OP_OPEN, 0, (char *) "sample.txt", 0, 1);
+  CHECK (ring_enter (1) == 1, "submit open");
+  CHECK ((handle = complete (1)) > 1, "open \"sample.txt\"");
+
+  submit (RING_OP_READ, handle, buf, sizeof buf, 2);
+  submit (RING_OP_SEEK, handle, NULL, 0, 3);
+  submit (RING_OP_READ, handle, buf2, sizeof buf2, 4);
+  submit (RING_OP_NOP, 0, NULL, 0, 5);
+  submit (RING_OP_CLOSE, handle, NULL, 0, 6);
+  CHECK (ring_enter (5) == 5, "submit read, seek, read, nop, close");
+
+  if ((result = complete (2)) != sizeof buf)
+    fail ("read returned %d instead of %zu", result, sizeof buf);
+  if ((result = complete (3)) != 0)
+    fail ("seek returned %d instead of 0", result);
+  if ((result = complete (4)) != sizeof buf2)
+    fail ("read returned %d instead of %zu", result, sizeof buf2);
+  if ((result = complete (5)) != 0)
+    fail ("nop returned %d instead of 0", result);
+  if ((result = complete (6)) != 0)
+    fail ("close returned %d instead of 0", result);
+  compare_bytes (buf, sample, sizeof buf, 0, "sample.txt");
+  compare_bytes (buf2, sample, sizeof buf2, 0, "sample.txt");
+  msg ("verified results");
+}
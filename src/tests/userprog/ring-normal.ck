@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ring-normal) begin
+(ring-normal) ring_setup
+(ring-normal) submit open
+(ring-normal) open "sample.txt"
+(ring-normal) submit read, seek, read, nop, close
+(ring-normal) verified results
+(ring-normal) end
+ring-normal: exit(0)
+EOF
+pass;
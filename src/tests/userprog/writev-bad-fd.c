@@ -0,0 +1,26 @@
+/* Tries to writev() to invalid fds,
+   which must either fail silently or terminate the process with
+   exit code -1. */
+
+#include <limits.h>
+#include <syscall.h>
+#include <uio.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf = 123;
+  struct iovec iov;
+
+  iov.iov_base = &buf;
+  iov.iov_len = 1;
+  writev (0x01012342, &iov, 1);
+  writev (7, &iov, 1);
+  writev (2546, &iov, 1);
+  writev (-5, &iov, 1);
+  writev (-8192, &iov, 1);
+  writev (INT_MIN + 1, &iov, 1);
+  writev (INT_MAX - 1, &iov, 1);
+}
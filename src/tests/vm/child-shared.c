@@ -0,0 +1,67 @@
+/* Child process of page-shared.
+   Checks a 64 kB read-only table, which every child maps from
+   the same shared frames, then encrypts and decrypts 1 MB of
+   zeros to push those frames out of memory, and checks the table
+   again. */
+
+#include <stdint.h>
+#include <string.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+const char *test_name = "child-shared";
+
+/* Byte N of the table. */
+#define T1(N) ((uint8_t) ((N) * 37 + 11))
+#define T4(N) T1 (N), T1 ((N) + 1), T1 ((N) + 2), T1 ((N) + 3)
+#define T16(N) T4 (N), T4 ((N) + 4), T4 ((N) + 8), T4 ((N) + 12)
+#define T64(N) T16 (N), T16 ((N) + 16), T16 ((N) + 32), T16 ((N) + 48)
+#define T256(N) T64 (N), T64 ((N) + 64), T64 ((N) + 128), T64 ((N) + 192)
+#define T1K(N) T256 (N), T256 ((N) + 256), T256 ((N) + 512), \
+               T256 ((N) + 768)
+#define T4K(N) T1K (N), T1K ((N) + 1024), T1K ((N) + 2048), \
+               T1K ((N) + 3072)
+#define T16K(N) T4K (N), T4K ((N) + 4096), T4K ((N) + 8192), \
+                T4K ((N) + 12288)
+#define T64K(N) T16K (N), T16K ((N) + 16384), T16K ((N) + 32768), \
+                T16K ((N) + 49152)
+
+#define TABLE_SIZE 65536
+static const uint8_t table[TABLE_SIZE] = { T64K (0) };
+
+#define SIZE (1024 * 1024)
+static char buf[SIZE];
+
+/* Checks that every byte of the table is still right. */
+static void
+check_table (void)
+{
+  size_t i;
+
+  for (i = 0; i < TABLE_SIZE; i++)
+    if (table[i] != T1 (i))
+      fail ("table byte %zu is %d, should be %d", i, table[i], T1 (i));
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *key = argv[argc - 1];
+  struct arc4 arc4;
+  size_t i;
+
+  check_table ();
+
+  /* Encrypt zeros, then decrypt them back. */
+  arc4_init (&arc4, key, strlen (key));
+  arc4_crypt (&arc4, buf, SIZE);
+  arc4_init (&arc4, key, strlen (key));
+  arc4_crypt (&arc4, buf, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != '\0')
+      fail ("byte %zu != 0", i);
+
+  check_table ();
+  return 0x42;
+}
@@ -0,0 +1,39 @@
+/* Maps a file several pages long, whose last page is partial,
+   changes a byte on every other page and the file's last byte,
+   unmaps it, and checks with read() that exactly those changes
+   were written back. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define SIZE (4 * 4096 + 100)
+
+static char expected[SIZE];
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    expected[i] = i % 251;
+  CHECK (create ("data", SIZE), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  if (write (handle, expected, SIZE) != SIZE)
+    fail ("write \"data\" failed");
+
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"data\"");
+  for (i = 0; i < SIZE; i += 2 * 4096)
+    ACTUAL[i + 17] = expected[i + 17] = 'x';
+  ACTUAL[SIZE - 1] = expected[SIZE - 1] = 'y';
+  msg ("munmap \"data\"");
+  munmap (map);
+  close (handle);
+
+  check_file ("data", expected, SIZE);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-writeback) begin
+(mmap-writeback) create "data"
+(mmap-writeback) open "data"
+(mmap-writeback) mmap "data"
+(mmap-writeback) munmap "data"
+(mmap-writeback) open "data" for verification
+(mmap-writeback) verified contents of "data"
+(mmap-writeback) close "data"
+(mmap-writeback) end
+EOF
+pass;
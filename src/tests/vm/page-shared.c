@@ -0,0 +1,24 @@
+/* Runs 4 child-shared processes at once, so that the frames
+   holding the read-only pages of their one executable are shared
+   among all of them, and evicted from under all of them, while
+   memory is short. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    CHECK ((children[i] = exec ("child-shared")) != -1,
+           "exec \"child-shared\"");
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+}
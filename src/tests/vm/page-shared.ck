@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-shared) begin
+(page-shared) exec "child-shared"
+(page-shared) exec "child-shared"
+(page-shared) exec "child-shared"
+(page-shared) exec "child-shared"
+(page-shared) wait for child 0
+(page-shared) wait for child 1
+(page-shared) wait for child 2
+(page-shared) wait for child 3
+(page-shared) end
+EOF
+pass;
@@ -0,0 +1,33 @@
+/* Grows the stack about 512 kB, a page at a time, by recursing
+   with a 1 kB array in each stack frame, and checks on the way
+   back up that every frame's array is intact.
+   This must succeed. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DEPTH 512
+
+/* Fills an array in this stack frame, recurses DEPTH times, and
+   then checks the array.  Returns the number of frames. */
+static int
+recurse (int depth)
+{
+  char buf[1024];
+  int frames;
+  size_t i;
+
+  memset (buf, depth, sizeof buf);
+  frames = depth > 0 ? recurse (depth - 1) : 0;
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (char) depth)
+      fail ("stack frame %d corrupted", depth);
+  return frames + 1;
+}
+
+void
+test_main (void)
+{
+  msg ("grew stack through %d frames", recurse (DEPTH - 1));
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pt-grow-deep) begin
+(pt-grow-deep) grew stack through 512 frames
+(pt-grow-deep) end
+EOF
+pass;
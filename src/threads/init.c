@@ -37,6 +37,10 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -45,6 +49,9 @@ uint32_t *init_page_dir;
 /* -f: Format the file system? */
 static bool format_filesys;
 
+/* -dirs: On-disk format of directories created by -f. */
+static enum dir_format format_dir_format = DIR_HASHED;
+
 /* -filesys, -scratch, -swap: Names of block devices to use,
    overriding the defaults. */
 static const char *filesys_bdev_name;
@@ -124,7 +131,13 @@ main (void)
   /* Initialize file system. */
   ide_init ();
   locate_block_devices ();
-  filesys_init (format_filesys);
+  filesys_init (format_filesys, format_dir_format);
+#endif
+
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_init ();
+  swap_init ();
 #endif
 
   printf ("Boot complete.\n");
@@ -243,6 +256,19 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-dirs"))
+        {
+          if (value == NULL)
+            PANIC ("option `-dirs' requires an argument");
+          else if (!strcmp (value, "linear"))
+            format_dir_format = DIR_LINEAR;
+          else if (!strcmp (value, "hashed"))
+            format_dir_format = DIR_HASHED;
+          else
+            PANIC ("unknown directory format `%s'", value);
+        }
+      else if (!strcmp (name, "-crash"))
+        filesys_crash = true;
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
@@ -371,6 +397,9 @@ usage (void)
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
+          "  -dirs=FORMAT       Format directories as `hashed' (default) or\n"
+          "                     `linear'.\n"
+          "  -crash             Leave metadata in the journal at power off.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
@@ -414,3 +414,85 @@ cond_broadcast (struct condition *cond, struct lock *lock)
     while (!list_empty (&cond->waiters))
         cond_signal (cond, lock);
 }
+
+/* Initializes readers-writer lock RW. */
+    void
+rwlock_init (struct rwlock *rw)
+{
+    ASSERT (rw != NULL);
+
+    lock_init (&rw->lock);
+    cond_init (&rw->readers_ok);
+    cond_init (&rw->writer_ok);
+    rw->readers = 0;
+    rw->waiting_writers = 0;
+    rw->writer = false;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.  A thread must not acquire RW again while
+   it holds it, because a writer may be waiting in between.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+    void
+rwlock_acquire_read (struct rwlock *rw)
+{
+    ASSERT (rw != NULL);
+
+    lock_acquire (&rw->lock);
+    while (rw->writer || rw->waiting_writers > 0)
+        cond_wait (&rw->readers_ok, &rw->lock);
+    rw->readers++;
+    lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+    void
+rwlock_release_read (struct rwlock *rw)
+{
+    ASSERT (rw != NULL);
+
+    lock_acquire (&rw->lock);
+    ASSERT (rw->readers > 0);
+    if (--rw->readers == 0 && rw->waiting_writers > 0)
+        cond_signal (&rw->writer_ok, &rw->lock);
+    lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no reader or writer
+   holds it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+    void
+rwlock_acquire_write (struct rwlock *rw)
+{
+    ASSERT (rw != NULL);
+
+    lock_acquire (&rw->lock);
+    rw->waiting_writers++;
+    while (rw->writer || rw->readers > 0)
+        cond_wait (&rw->writer_ok, &rw->lock);
+    rw->waiting_writers--;
+    rw->writer = true;
+    lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing.
+   Hands RW to the next waiting writer if there is one, otherwise
+   to every waiting reader. */
+    void
+rwlock_release_write (struct rwlock *rw)
+{
+    ASSERT (rw != NULL);
+
+    lock_acquire (&rw->lock);
+    ASSERT (rw->writer);
+    rw->writer = false;
+    if (rw->waiting_writers > 0)
+        cond_signal (&rw->writer_ok, &rw->lock);
+    else
+        cond_broadcast (&rw->readers_ok, &rw->lock);
+    lock_release (&rw->lock);
+}
@@ -52,6 +52,26 @@ void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 bool cond_sema_less_priority(const struct list_elem*, const struct list_elem*, void*);
 
+/* Readers-writer lock.  Any number of readers may hold the lock
+   at once, or a single writer.  Waiting writers are preferred
+   over new readers, so that a steady stream of readers cannot
+   starve a writer. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers_ok; /* Signaled when readers may enter. */
+    struct condition writer_ok; /* Signaled when a writer may enter. */
+    int readers;                /* Number of readers holding the lock. */
+    int waiting_writers;        /* Number of writers waiting. */
+    bool writer;                /* Held by a writer? */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
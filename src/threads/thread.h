@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include "synch.h"
 #include <stdint.h>
@@ -139,7 +140,25 @@ struct thread
     struct file_struct * files;        /* Pointer to open files */
     struct file * exe;                  /* Executable file pointer, owned by process.c:load*/
     void * aux;                         /* For storing the pointer to aux data*/
+    struct ring * ring;                 /* Submission ring, owned by syscall.c */
 
+#endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    struct list pinned_pages;           /* Pages pinned by page_pin(). */
+    void *user_esp;                     /* User stack pointer, saved on
+                                           entry to the kernel. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Identifier for next mapping. */
+#endif
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal_begin(). */
+    size_t journal_cnt;                 /* Sectors changed by the current
+                                           operation. */
 #endif
     
     /* Owned by thread.c. */
@@ -5,6 +5,9 @@
 #include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -151,9 +154,18 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in the page to which FAULT_ADDR refers, if the process
+     has one there or it grows the stack.  A fault in the kernel
+     comes from a system call, which saved the user's stack
+     pointer on entry. */
+  if (user)
+    thread_current ()->user_esp = f->esp;
+  if (not_present && thread_current ()->pagedir != NULL
+      && page_load (fault_addr, write))
+    return;
+#endif
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
@@ -21,6 +21,10 @@
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load(const struct cmd_frame *, void (**eip) (void), void **);
@@ -287,9 +291,6 @@ process_exit (void)
   /* Close all open files */
   done_files(cur);
 
-  /*  Close itself  */
-  file_close(cur->exe);
-
   /* Free aux */
   palloc_free_page(cur->aux);
 
@@ -305,10 +306,18 @@ process_exit (void)
          directory before destroying the process's page
          directory, or our active page directory will be one
          that's been freed (and cleared). */
+#ifdef VM
+      mmap_unmap_all ();
+      page_table_destroy ();
+#endif
       cur->pagedir = NULL;
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+
+  /* Close itself only now: its pages read from it, and shared
+     frames are keyed by its inode, until the page table is gone. */
+  file_close(cur->exe);
 }
 
 //static void
@@ -462,6 +471,15 @@ load (const struct cmd_frame *cf, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
+#ifdef VM
+  if (!page_table_init ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto done;
+    }
+  mmap_init ();
+#endif
   process_activate ();
 
   /* Open executable file. */
@@ -565,7 +583,9 @@ load (const struct cmd_frame *cf, void (**eip) (void), void **esp)
 }
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -624,6 +644,9 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here, and read in when first touched.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -643,6 +666,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where this page comes from. */
+      if (!page_add_file (upage, file, ofs, page_read_bytes, writable))
+        return false;
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -662,6 +691,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -676,7 +706,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp, const struct cmd_frame *cf) 
 {
-  uint8_t *kpage;
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
   bool success = false;
   int argc, argv_len;
   char * stack_ptr, * argv_start;
@@ -685,58 +715,64 @@ setup_stack (void **esp, const struct cmd_frame *cf)
   argc = cf->argc;
   argv_len = cf->argv_len;
 
+#ifdef VM
+  success = page_add_zero (upage, true) && page_load (upage, true);
+#else
+  {
+    uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+    if (kpage != NULL)
+      {
+        success = install_page (upage, kpage, true);
+        if (!success)
+          palloc_free_page (kpage);
+      }
+  }
+#endif
+  if (success){
+    //TODO: set up stack properly        
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (kpage != NULL) 
-    {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success){
-        //TODO: set up stack properly        
-
-        /* Pushed argvs, need to take into account spaces */
-        stack_ptr -= argv_len;
-        memcpy(stack_ptr, cf->prog_name, argv_len);
-        
-        /* Word Align stack_ptr */
-        argv_start = stack_ptr;
-        stack_ptr  = (char*) ((uintptr_t)(stack_ptr) & ~0x3);
-        
-        /* Find the esp  */
-        stack_ptr = (stack_ptr - 
-                4 * (cf->argc + 4)); /* sentinel + *argv+ argc + ret */ 
-        *esp = (void*)stack_ptr;
-
-        /* Skip fake return address */
-        *(int *)stack_ptr = 0;
-        stack_ptr += 4;
-        
-        /* Set argc */
-        *(int*)stack_ptr = cf->argc;
-        stack_ptr += 4;
-
-        /* Set *argv */
-        *(char**)stack_ptr = stack_ptr+4;
-        stack_ptr += 4;
-
-        /* Set The rest argvs address */
-        while(argc--) {
-            *(void **)stack_ptr = argv_start;
-            argv_start += (strlen(argv_start)+1);
-            stack_ptr+=4;
-        }
+    /* Pushed argvs, need to take into account spaces */
+    stack_ptr -= argv_len;
+    memcpy(stack_ptr, cf->prog_name, argv_len);
+    
+    /* Word Align stack_ptr */
+    argv_start = stack_ptr;
+    stack_ptr  = (char*) ((uintptr_t)(stack_ptr) & ~0x3);
+    
+    /* Find the esp  */
+    stack_ptr = (stack_ptr - 
+            4 * (cf->argc + 4)); /* sentinel + *argv+ argc + ret */ 
+    *esp = (void*)stack_ptr;
+
+    /* Skip fake return address */
+    *(int *)stack_ptr = 0;
+    stack_ptr += 4;
+    
+    /* Set argc */
+    *(int*)stack_ptr = cf->argc;
+    stack_ptr += 4;
+
+    /* Set *argv */
+    *(char**)stack_ptr = stack_ptr+4;
+    stack_ptr += 4;
+
+    /* Set The rest argvs address */
+    while(argc--) {
+        *(void **)stack_ptr = argv_start;
+        argv_start += (strlen(argv_start)+1);
+        stack_ptr+=4;
+    }
 
-        /* Set zero */
-        *stack_ptr = 0;
+    /* Set zero */
+    *stack_ptr = 0;
 
 
-        //hex_dump((uintptr_t)(*esp), *esp, 92, true);
-      }
-      else
-        palloc_free_page (kpage);
-    }
+    //hex_dump((uintptr_t)(*esp), *esp, 92, true);
+  }
   return success;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -756,3 +792,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
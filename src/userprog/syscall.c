@@ -2,20 +2,31 @@
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <blkstat.h>
+#include <ring.h>
 #include <syscall-nr.h>
+#include <uio.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/pte.h"
 #include "threads/malloc.h"
-#include "threads/synch.h"
+#include "threads/palloc.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "filesys/fdtable.h"
 #include "filesys/off_t.h"
 #include "filesys/inode.h"
+#include "devices/block.h"
 #include "devices/shutdown.h"
 #include "devices/input.h"
 #include <user/syscall.h>
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 /* Syscalls */
 static void syscall_handler (struct intr_frame *);
@@ -32,20 +43,49 @@ static void syscall_filesize(int*, struct intr_frame *);
 static void syscall_read(int*, struct intr_frame *);
 static void syscall_seek(int*, struct intr_frame *);
 static void syscall_tell(int*, struct intr_frame*);
+static void syscall_readv(int*, struct intr_frame*);
+static void syscall_writev(int*, struct intr_frame*);
+static void syscall_pread(int*, struct intr_frame*);
+static void syscall_pwrite(int*, struct intr_frame*);
+static void syscall_ring_setup(int*, struct intr_frame*);
+static void syscall_ring_enter(int*, struct intr_frame*);
+static void syscall_blkstat(int*, struct intr_frame*);
+#ifdef VM
+static void syscall_mmap(int*, struct intr_frame*);
+static void syscall_munmap(int*, struct intr_frame*);
+#endif
 
 
 /* Utility methods */
 static bool valid_syscall_num(const int);
 static bool get_syscall_argv(int,  int*);
 static bool valid_user_vaddr(const void*);
+static bool valid_user_buffer(const void*, unsigned, bool);
+static bool copy_in_string(const char *, char **);
+static void unpin_user_buffers(void);
+static size_t buffer_pages(const void*, size_t);
+static unsigned pin_chunk(const void*, unsigned);
+static off_t transfer(struct file *, uint8_t *, unsigned, bool, off_t);
+static bool copy_in_iovec(struct iovec *, const struct iovec *, int);
+static size_t iovec_pages(const struct iovec *, int);
+static bool pin_iovec(const struct iovec *, int, bool);
+static int ring_do(const struct ring_sqe *);
 static bool valid_fd(int);
 
 static void _exit(const int);
 
+/*
+ * Most pages of user buffers one system call pins at a time, so that
+ * pinned pages can never take up the whole user pool and leave
+ * eviction nothing to reclaim.  A read or write of a larger buffer
+ * is done a piece at a time; a request that needs its buffers pinned
+ * all at once fails with -1 instead.
+ */
+#define PIN_MAX 64
+
 typedef void (*syscall_func) (int*, struct intr_frame*);
 static syscall_func syscall_table[SYS_NUM];
 static int syscall_argc_table[SYS_NUM];
-static struct lock sys_filesys_lock;
 
 
 void
@@ -53,9 +93,6 @@ syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 
-  lock_init(&sys_filesys_lock);
-
-
   //sys_exit
   syscall_table[SYS_EXIT] = syscall_exit;
   syscall_argc_table[SYS_EXIT] = 1;
@@ -108,6 +145,44 @@ syscall_init (void)
   syscall_table[SYS_REMOVE] = syscall_remove;
   syscall_argc_table[SYS_REMOVE] = 1;
 
+  //readv
+  syscall_table[SYS_READV] = syscall_readv;
+  syscall_argc_table[SYS_READV] = 3;
+
+  //writev
+  syscall_table[SYS_WRITEV] = syscall_writev;
+  syscall_argc_table[SYS_WRITEV] = 3;
+
+  //pread
+  syscall_table[SYS_PREAD] = syscall_pread;
+  syscall_argc_table[SYS_PREAD] = 4;
+
+  //pwrite
+  syscall_table[SYS_PWRITE] = syscall_pwrite;
+  syscall_argc_table[SYS_PWRITE] = 4;
+
+  //ring_setup
+  syscall_table[SYS_RING_SETUP] = syscall_ring_setup;
+  syscall_argc_table[SYS_RING_SETUP] = 1;
+
+  //ring_enter
+  syscall_table[SYS_RING_ENTER] = syscall_ring_enter;
+  syscall_argc_table[SYS_RING_ENTER] = 1;
+
+  //blkstat
+  syscall_table[SYS_BLKSTAT] = syscall_blkstat;
+  syscall_argc_table[SYS_BLKSTAT] = 2;
+
+#ifdef VM
+  //mmap
+  syscall_table[SYS_MMAP] = syscall_mmap;
+  syscall_argc_table[SYS_MMAP] = 2;
+
+  //munmap
+  syscall_table[SYS_MUNMAP] = syscall_munmap;
+  syscall_argc_table[SYS_MUNMAP] = 1;
+#endif
+
 }
 
 static void
@@ -126,9 +201,7 @@ syscall_tell(int* argv, struct intr_frame * f)
         goto end;
     }
 
-    lock_acquire(&sys_filesys_lock);
     offset = file_tell(file);
-    lock_release(&sys_filesys_lock);
 
 end:
     f->eax = (uint32_t) offset;
@@ -150,9 +223,7 @@ syscall_seek(int* argv, struct intr_frame* f UNUSED)
     if(file == NULL)
         return;
 
-    lock_acquire(&sys_filesys_lock);
     file_seek(file, (off_t) pos);    
-    lock_release(&sys_filesys_lock);
 }
 
 
@@ -162,9 +233,7 @@ syscall_filesize(int * argv, struct intr_frame*f)
     int fd = *(int*) argv;
 
     if(fd - FD_OFFSET < FD_MAX_NR && fd -FD_OFFSET >=0) {
-        lock_acquire(&sys_filesys_lock);
         f->eax =(uint32_t)file_size(fd);
-        lock_release(&sys_filesys_lock);
     } else {
         f->eax = (uint32_t) 0;
     }
@@ -175,48 +244,309 @@ syscall_read(int * argv, struct intr_frame * f)
 {
     int fd = *(int*) argv++;
     void * buffer = * (void**) argv++;
-    unsigned size = *(unsigned *) argv, i;
+    unsigned size = *(unsigned *) argv;
     struct file * file;
-    uint8_t* buf_stdin;
     off_t ret = -1;
     
     
-    if((!valid_user_vaddr(buffer))
+    if((!valid_user_buffer(buffer, pin_chunk(buffer, size), true))
             || (!valid_fd(fd) && fd != STDIN_FILENO))
         _exit(-1);
 
     if(fd == STDIN_FILENO){
+        ret = transfer(NULL, buffer, size, false, -1);
+    } else {
+        file = fd_file(fd);
+        if(file != NULL){
+            ret = transfer(file, buffer, size, false, -1);
+        }
+    }
+
+    f->eax = (uint32_t) ret;
+}
+
+/*
+ * Reads into several buffers with one pass through the file system,
+ * filling each buffer before moving on to the next.
+ */
+static void
+syscall_readv(int * argv, struct intr_frame * f)
+{
+    int fd = *(int*) argv++;
+    const struct iovec * uiov = *(const struct iovec **) argv++;
+    int iovcnt = *(int*) argv;
+    struct iovec iov[IOV_MAX];
+    struct file * file;
+    off_t ret = -1;
+    int i;
+    size_t j;
+
+    if(!valid_fd(fd) && fd != STDIN_FILENO)
+        _exit(-1);
+    if(iovcnt < 0 || iovcnt > IOV_MAX)
+        goto end;
+    if(!copy_in_iovec(iov, uiov, iovcnt))
+        _exit(-1);
+    if(iovec_pages(iov, iovcnt) > PIN_MAX)
+        goto end;
+    if(!pin_iovec(iov, iovcnt, true))
+        _exit(-1);
+
+    if(fd == STDIN_FILENO) {
+        ret = 0;
+        for(i = 0; i < iovcnt; i++)
+            for(j = 0; j < iov[i].iov_len; j++) {
+                ((uint8_t*) iov[i].iov_base)[j] = input_getc();
+                ret++;
+            }
+    } else {
+        file = fd_file(fd);
+        if(file != NULL)
+            ret = file_readv(file, iov, iovcnt);
+    }
+
+end:
+    f->eax = (uint32_t) ret;
+}
+
+/*
+ * Writes several buffers as a single write, e.g. a header and its
+ * payload, with one pass through the file system.
+ */
+static void
+syscall_writev(int * argv, struct intr_frame * f)
+{
+    int fd = *(int*) argv++;
+    const struct iovec * uiov = *(const struct iovec **) argv++;
+    int iovcnt = *(int*) argv;
+    struct iovec iov[IOV_MAX];
+    struct file * file;
+    off_t ret = -1;
+    int i;
+
+    if(!(valid_fd(fd) || fd == STDOUT_FILENO || fd == STDERR_FILENO))
+        _exit(-1);
+    if(iovcnt < 0 || iovcnt > IOV_MAX)
+        goto end;
+    if(!copy_in_iovec(iov, uiov, iovcnt))
+        _exit(-1);
+    if(iovec_pages(iov, iovcnt) > PIN_MAX)
+        goto end;
+    if(!pin_iovec(iov, iovcnt, false))
+        _exit(-1);
+
+    if(fd == STDOUT_FILENO || fd == STDERR_FILENO) {
         ret = 0;
-        i = 0;
-        buf_stdin = (uint8_t*) buffer;
-        while(i < size) {
-            *buf_stdin++ = input_getc();    
-            ret++; i++;
+        for(i = 0; i < iovcnt; i++) {
+            putbuf(iov[i].iov_base, iov[i].iov_len);
+            ret += iov[i].iov_len;
         }
     } else {
-        lock_acquire(&sys_filesys_lock);
+        if((file = fd_file(fd)) == NULL)
+            _exit(-1);
+
+        if(!inode_can_write(file->inode))
+            ret = 0;
+        else
+            ret = file_writev(file, iov, iovcnt);
+    }
+
+end:
+    f->eax = (uint32_t) ret;
+}
+
+/*
+ * Reads from a given position in a file, leaving the file's
+ * current position alone.
+ */
+static void
+syscall_pread(int * argv, struct intr_frame * f)
+{
+    int fd = *(int*) argv++;
+    void * buffer = *(void**) argv++;
+    unsigned size = *(unsigned *) argv++;
+    unsigned offset = *(unsigned *) argv;
+    struct file * file;
+    off_t ret = -1;
+
+    if(!valid_fd(fd) || !valid_user_buffer(buffer, pin_chunk(buffer, size),
+                                           true))
+        _exit(-1);
+
+    file = fd_file(fd);
+    if(file != NULL && (off_t) offset >= 0)
+        ret = transfer(file, buffer, size, false, (off_t) offset);
+
+    f->eax = (uint32_t) ret;
+}
+
+/*
+ * Writes at a given position in a file, leaving the file's
+ * current position alone.
+ */
+static void
+syscall_pwrite(int * argv, struct intr_frame * f)
+{
+    int fd = *(int*) argv++;
+    const void * buffer = *(void**) argv++;
+    unsigned size = *(unsigned *) argv++;
+    unsigned offset = *(unsigned *) argv;
+    struct file * file;
+    off_t ret = -1;
 
+    if(!valid_fd(fd) || !valid_user_buffer(buffer, pin_chunk(buffer, size),
+                                           false))
+        _exit(-1);
+
+    if((file = fd_file(fd)) == NULL)
+        _exit(-1);
+
+    if(!inode_can_write(file->inode))
+        ret = 0;
+    else if((off_t) offset >= 0)
+        ret = transfer(file, (uint8_t *) buffer, size, true, (off_t) offset);
+
+    f->eax = (uint32_t) ret;
+}
+
+/*
+ * Registers the ring at the given user address for ring_enter(),
+ * replacing any ring registered before.  A null address just
+ * unregisters the current ring.
+ */
+static void
+syscall_ring_setup(int * argv, struct intr_frame * f)
+{
+    struct ring * ring = *(struct ring **) argv;
+    struct thread * cur = thread_current();
+    bool success = false;
+
+    if(ring == NULL) {
+        cur->ring = NULL;
+        success = true;
+    } else if(valid_user_buffer(ring, sizeof *ring, true)) {
+        cur->ring = ring;
+        success = true;
+    }
+
+    f->eax = (uint32_t) success;
+}
+
+/*
+ * Carries out up to TO_SUBMIT requests queued in the registered
+ * ring, one after another, all in this one trap.  Stops early if the
+ * completion queue fills up.  Returns the number of requests taken,
+ * whose results are all in the completion queue, or -1 if there is
+ * no ring or its indexes are corrupt.
+ */
+static void
+syscall_ring_enter(int * argv, struct intr_frame * f)
+{
+    unsigned to_submit = *(unsigned *) argv;
+    struct ring * ring = thread_current()->ring;
+    uint32_t head, tail;
+    int ret = -1;
+
+    /* The ring's pages could have gone away since ring_setup(). */
+    if(ring == NULL || !valid_user_buffer(ring, sizeof *ring, true))
+        goto end;
+
+    head = ring->sq_head;
+    tail = ring->sq_tail;
+    if(tail - head > RING_ENTRIES
+            || ring->cq_tail - ring->cq_head > RING_ENTRIES)
+        goto end;
+
+    ret = 0;
+    while((unsigned) ret < to_submit && head != tail
+            && ring->cq_tail - ring->cq_head < RING_ENTRIES) {
+        /* Copy the request first, since the program may change the
+         * entry under us once SQ_HEAD moves past it. */
+        struct ring_sqe sqe = ring->sq[head % RING_ENTRIES];
+        struct ring_cqe * cqe;
+
+        ring->sq_head = ++head;
+        cqe = &ring->cq[ring->cq_tail % RING_ENTRIES];
+        cqe->user_data = sqe.user_data;
+        cqe->res = ring_do(&sqe);
+        ring->cq_tail++;
+        ret++;
+
+        /* Let go of the request's buffers before the next one, so
+         * that a long ring pins no more than a single request. */
+        unpin_user_buffers();
+        if(!valid_user_buffer(ring, sizeof *ring, true))
+            break;
+    }
+
+end:
+    f->eax = (uint32_t) ret;
+}
+
+/* Copies the statistics of the IDX'th block device, in probe
+   order, to user memory.  Returns false if there is no such
+   device. */
+static void
+syscall_blkstat(int * argv, struct intr_frame * f)
+{
+    unsigned idx = *(unsigned *) argv++;
+    struct blkstat * stats = *(struct blkstat **) argv;
+    struct block * block;
+
+    if(!valid_user_buffer(stats, sizeof *stats, true))
+        _exit(-1);
+
+    for(block = block_first(); block != NULL && idx > 0; idx--)
+        block = block_next(block);
+    if(block != NULL)
+        block_get_stats(block, stats);
+
+    f->eax = (uint32_t) (block != NULL);
+}
+
+#ifdef VM
+/*
+ * Maps the file open as FD at ADDR.  Unlike the other calls, a bad fd
+ * or address just fails, with MAP_FAILED.
+ */
+static void
+syscall_mmap(int * argv, struct intr_frame * f)
+{
+    int fd = *(int*) argv++;
+    void * addr = *(void **) argv;
+    struct file * file;
+    mapid_t ret = MAP_FAILED;
+
+    if(valid_fd(fd)) {
         file = fd_file(fd);
-        if(file != NULL){
-            ret = file_read(file, buffer, (off_t) size);
-        }
-        lock_release(&sys_filesys_lock);
+        if(file != NULL)
+            ret = mmap_map(file, addr);
     }
 
     f->eax = (uint32_t) ret;
 }
 
+static void
+syscall_munmap(int * argv, struct intr_frame * f UNUSED)
+{
+    mapid_t mapid = *(mapid_t *) argv;
+
+    mmap_unmap(mapid);
+}
+#endif
+
 static void
 syscall_remove(int * argv, struct intr_frame *f)
 {
 
     const char * file = *(char**) argv;
-    if(!valid_user_vaddr(file))
+    char * name;
+
+    if(!copy_in_string(file, &name))
         _exit(-1);
 
-    lock_acquire(&sys_filesys_lock);
-    f->eax = filesys_remove(file);
-    lock_release(&sys_filesys_lock);
+    f->eax = name != NULL && filesys_remove(name);
+    palloc_free_page(name);
 }
 
 static void
@@ -225,9 +555,7 @@ syscall_close(int * argv, struct intr_frame *f UNUSED)
     int fd = *(int*) argv;
     
     if(valid_fd(fd)) {
-        lock_acquire(&sys_filesys_lock);
         process_close(fd);
-        lock_release(&sys_filesys_lock);
     }
 }
 
@@ -236,13 +564,15 @@ static void
 syscall_open(int * argv, struct intr_frame *f )
 {
     const char * file = *(char**) argv;
-    int fd;
-    if(!valid_user_vaddr(file))
+    char * name;
+    int fd = -1;
+
+    if(!copy_in_string(file, &name))
         _exit(-1);
 
-    lock_acquire(&sys_filesys_lock);
-    fd = process_open(file);
-    lock_release(&sys_filesys_lock);
+    if(name != NULL)
+        fd = process_open(name);
+    palloc_free_page(name);
 
     ASSERT(fd != STDIN_FILENO && fd != STDOUT_FILENO);
 
@@ -254,14 +584,15 @@ syscall_create(int* argv, struct intr_frame *f)
 {
     const char *file = *(char**) argv++;
     unsigned initial_size = *(unsigned *) argv;
+    char * name;
     bool success = false;
 
-    if(!valid_user_vaddr(file))
+    if(!copy_in_string(file, &name))
         _exit(-1);
-    
-    lock_acquire(&sys_filesys_lock);
-    success  = filesys_create(file,(off_t)initial_size);
-    lock_release(&sys_filesys_lock);
+
+    if(name != NULL)
+        success = filesys_create(name, (off_t) initial_size);
+    palloc_free_page(name);
 
     f->eax =(uint32_t) success;
 }
@@ -273,6 +604,9 @@ syscall_handler (struct intr_frame *f)
   int syscall_num;
   int * esp = f->esp;
 
+#ifdef VM
+  thread_current()->user_esp = f->esp;
+#endif
   if(!valid_user_vaddr(esp) || !valid_syscall_num(*esp)){
       _exit(-1);
   }
@@ -284,13 +618,14 @@ syscall_handler (struct intr_frame *f)
   }
 
   syscall_table[syscall_num](esp, f);
+  unpin_user_buffers();
 }
 
 
 static inline bool
 valid_syscall_num(const int num) 
 {
-    return SYS_HALT <= num && num <SYS_INUMBER;
+    return SYS_HALT <= num && num < SYS_NUM && syscall_table[num] != NULL;
 }
 
 
@@ -311,8 +646,295 @@ get_syscall_argv(const int syscall_num, int* esp)
 static bool 
 valid_user_vaddr(const void * addr)
 {
+#ifdef VM
+    return addr != NULL && page_load(addr, false);
+#else
     return (addr != NULL && is_user_vaddr(addr) 
             && lookup_page(thread_current()->pagedir, addr, false) != NULL);
+#endif
+}
+
+/*
+ * Is every page of the SIZE bytes at BUFFER mapped in user space,
+ * and writable if WRITABLE?  The kernel copies file data straight
+ * in and out of the user's pages, so the whole range is checked up
+ * front rather than faulting halfway through.  With virtual memory,
+ * pages not yet in memory are brought in here, for the same reason,
+ * and pinned until the system call returns.
+ */
+static bool
+valid_user_buffer(const void * buffer, unsigned size, bool writable)
+{
+    uint32_t * pd = thread_current()->pagedir;
+    const uint8_t * page;
+    const uint8_t * end = (const uint8_t *) buffer + size;
+
+    if(buffer == NULL || end < (const uint8_t *) buffer)
+        return false;
+    if(size == 0)
+        return true;
+
+    for(page = pg_round_down(buffer); page < end; page += PGSIZE) {
+        uint32_t * pte;
+
+        if(!is_user_vaddr(page))
+            return false;
+#ifdef VM
+        if(!page_pin(page, writable))
+            return false;
+#endif
+        pte = lookup_page(pd, page, false);
+        if(pte == NULL || !(*pte & PTE_P) || !(*pte & PTE_U)
+                || (writable && !(*pte & PTE_W)))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Copies the null-terminated string at USTR in user space into a newly
+ * allocated page, checking each page of it as it goes, and stores the copy
+ * into *KSTR, to be freed with palloc_free_page().  A file name must be
+ * copied in before it is handed to the file system, which looks at it while
+ * holding its locks, inside a journal operation, where faulting in a user
+ * page could mean evicting another.  Returns false if USTR is a bad pointer.
+ * Otherwise returns true, with *KSTR null if memory ran out or the string
+ * does not fit in a page.
+ */
+static bool
+copy_in_string(const char * ustr, char ** kstr)
+{
+    char * copy;
+    size_t i;
+
+    *kstr = NULL;
+    if(!valid_user_vaddr(ustr))
+        return false;
+    copy = palloc_get_page(0);
+    if(copy == NULL)
+        return true;
+
+    for(i = 0; i < PGSIZE; i++) {
+        if(pg_ofs(ustr + i) == 0 && !valid_user_vaddr(ustr + i)) {
+            palloc_free_page(copy);
+            return false;
+        }
+        copy[i] = ustr[i];
+        if(copy[i] == '\0') {
+            *kstr = copy;
+            return true;
+        }
+    }
+    palloc_free_page(copy);
+    return true;
+}
+
+/*
+ * Unpins every page pinned by valid_user_buffer() so far in this
+ * system call.
+ */
+static void
+unpin_user_buffers(void)
+{
+#ifdef VM
+    page_unpin_all();
+#endif
+}
+
+/*
+ * Returns the number of pages the SIZE bytes at BUFFER touch.
+ */
+static size_t
+buffer_pages(const void * buffer, size_t size)
+{
+    if(size == 0)
+        return 0;
+    return pg_no((const uint8_t *) buffer + size - 1) - pg_no(buffer) + 1;
+}
+
+/*
+ * Returns how many of the SIZE bytes at BUFFER lie within the first
+ * PIN_MAX pages the buffer touches.
+ */
+static unsigned
+pin_chunk(const void * buffer, unsigned size)
+{
+    unsigned room = PIN_MAX * PGSIZE - pg_ofs(buffer);
+    return size < room ? size : room;
+}
+
+/*
+ * Reads into, or writes from if WRITE, the SIZE bytes at user
+ * address BUFFER, using FILE at OFFSET, or at its current position
+ * if OFFSET is negative, or the keyboard or console if FILE is null.
+ * The buffer is checked and pinned PIN_MAX pages at a time, and
+ * unpinned after each piece.  Kills the process if the buffer is
+ * bad.  Returns the number of bytes transferred.
+ */
+static off_t
+transfer(struct file * file, uint8_t * buffer, unsigned size, bool write,
+         off_t offset)
+{
+    off_t total = 0;
+
+    while(size > 0) {
+        unsigned chunk = pin_chunk(buffer, size);
+        off_t n;
+        unsigned i;
+
+        if(!valid_user_buffer(buffer, chunk, !write))
+            _exit(-1);
+        if(file == NULL) {
+            if(write)
+                putbuf((const char *) buffer, chunk);
+            else
+                for(i = 0; i < chunk; i++)
+                    buffer[i] = input_getc();
+            n = chunk;
+        } else if(write)
+            n = offset < 0 ? file_write(file, buffer, chunk)
+                           : file_write_at(file, buffer, chunk, offset);
+        else
+            n = offset < 0 ? file_read_direct(file, buffer, chunk)
+                           : file_read_at(file, buffer, chunk, offset);
+        unpin_user_buffers();
+
+        total += n;
+        if((unsigned) n < chunk)
+            break;
+        if(offset >= 0)
+            offset += n;
+        buffer += n;
+        size -= n;
+    }
+    return total;
+}
+
+/*
+ * Copies the CNT buffer descriptors at user address UIOV into IOV.
+ * Fails if UIOV is bad or if the buffers' total size does not fit
+ * in an off_t.
+ */
+static bool
+copy_in_iovec(struct iovec * iov, const struct iovec * uiov, int cnt)
+{
+    size_t total = 0;
+    int i;
+
+    if(cnt == 0)
+        return true;
+    if(!valid_user_buffer(uiov, cnt * sizeof *uiov, false))
+        return false;
+    memcpy(iov, uiov, cnt * sizeof *iov);
+
+    for(i = 0; i < cnt; i++) {
+        if(iov[i].iov_len > (size_t) INT32_MAX - total)
+            return false;
+        total += iov[i].iov_len;
+    }
+    return true;
+}
+
+/*
+ * Returns the number of pages the CNT buffers in IOV touch, in all.
+ */
+static size_t
+iovec_pages(const struct iovec * iov, int cnt)
+{
+    size_t pages = 0;
+    int i;
+
+    for(i = 0; i < cnt; i++)
+        pages += buffer_pages(iov[i].iov_base, iov[i].iov_len);
+    return pages;
+}
+
+/*
+ * Checks each of the CNT buffers in IOV with valid_user_buffer(),
+ * pinning them all until the system call returns.
+ */
+static bool
+pin_iovec(const struct iovec * iov, int cnt, bool writable)
+{
+    int i;
+
+    for(i = 0; i < cnt; i++)
+        if(!valid_user_buffer(iov[i].iov_base, iov[i].iov_len, writable))
+            return false;
+    return true;
+}
+
+/*
+ * Carries out a request taken from the submission ring the way the
+ * matching system call would, and returns its result.  A bad fd or
+ * buffer fails just the request, with -1, instead of killing the
+ * process.
+ */
+static int
+ring_do(const struct ring_sqe * sqe)
+{
+    struct file * file = NULL;
+    unsigned i;
+
+    if(valid_fd(sqe->fd))
+        file = fd_file(sqe->fd);
+
+    switch(sqe->op) {
+    case RING_OP_NOP:
+        return 0;
+
+    case RING_OP_READ:
+        if(buffer_pages(sqe->addr, sqe->len) > PIN_MAX
+                || !valid_user_buffer(sqe->addr, sqe->len, true))
+            return -1;
+        if(sqe->fd == STDIN_FILENO) {
+            for(i = 0; i < sqe->len; i++)
+                ((uint8_t *) sqe->addr)[i] = input_getc();
+            return sqe->len;
+        }
+        return file != NULL ? file_read_direct(file, sqe->addr, sqe->len) : -1;
+
+    case RING_OP_WRITE:
+        if(buffer_pages(sqe->addr, sqe->len) > PIN_MAX
+                || !valid_user_buffer(sqe->addr, sqe->len, false))
+            return -1;
+        if(sqe->fd == STDOUT_FILENO || sqe->fd == STDERR_FILENO) {
+            putbuf(sqe->addr, sqe->len);
+            return sqe->len;
+        }
+        if(file == NULL)
+            return -1;
+        if(!inode_can_write(file->inode))
+            return 0;
+        return file_write(file, sqe->addr, sqe->len);
+
+    case RING_OP_SEEK:
+        if(file == NULL)
+            return -1;
+        file_seek(file, (off_t) sqe->len);
+        return 0;
+
+    case RING_OP_OPEN: {
+        char * name;
+        int fd = -1;
+
+        if(!copy_in_string(sqe->addr, &name))
+            return -1;
+        if(name != NULL)
+            fd = process_open(name);
+        palloc_free_page(name);
+        return fd;
+    }
+
+    case RING_OP_CLOSE:
+        if(!valid_fd(sqe->fd))
+            return -1;
+        process_close(sqe->fd);
+        return 0;
+
+    default:
+        return -1;
+    }
 }
 
 static void
@@ -332,12 +954,12 @@ syscall_write(int* argv, struct intr_frame * cf)
     struct file * file;
     
     if(!(valid_fd(fd) || fd == STDOUT_FILENO || fd == STDERR_FILENO)
-            || !valid_user_vaddr(buffer)) {
+            || !valid_user_buffer(buffer, pin_chunk(buffer, size), false)) {
        _exit(-1); 
     }
 
     if(fd == STDOUT_FILENO)
-        putbuf(buffer, size);
+        size = transfer(NULL, buffer, size, true, -1);
     else {
         if((file=fd_file(fd)) == NULL)
             _exit(-1);
@@ -347,9 +969,7 @@ syscall_write(int* argv, struct intr_frame * cf)
             goto end;
         }
 
-        lock_acquire(&sys_filesys_lock);
-        size = file_write(file, buffer, (off_t) size);
-        lock_release(&sys_filesys_lock);
+        size = transfer(file, buffer, size, true, -1);
     }
 end: 
     cf->eax = (uint32_t) size;
@@ -372,9 +992,12 @@ static void
 syscall_exec(int* argv, struct intr_frame * cf)
 {
     const char *cmd_line = *(char**) argv;
+    char * copy;
     pid_t pid = (pid_t) TID_ERROR;
-    if(valid_user_vaddr(cmd_line))
-        pid = process_execute(cmd_line);
+
+    if(copy_in_string(cmd_line, &copy) && copy != NULL)
+        pid = process_execute(copy);
+    palloc_free_page(copy);
 
     cf->eax = (uint32_t) pid;
 }
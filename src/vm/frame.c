@@ -0,0 +1,364 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Frame table.
+
+   Every frame of the user pool that holds a page is listed here.
+   When the pool runs dry, a frame is taken from another page by
+   the clock algorithm: the clock hand sweeps around the list,
+   giving each page whose accessed bit is set a second chance by
+   clearing the bit, and evicts the first page whose bit is
+   already clear.
+
+   A frame is pinned while its page is being read in or written
+   out, and while a system call or a disk transfer is using it,
+   and is never chosen then.  A page whose lock is held, because
+   its process is busy with it, is passed over too, so that the
+   clock never waits on a page.
+
+   A read-only page of an executable is the same in every process
+   that runs it, so it is read into one frame that all of them
+   map, found in the shared frame table by the executable's inode
+   and the page's place in it.  The frame is freed when the last
+   process lets go of it.  Such a frame is never dirty, so the
+   clock evicts it by unmapping it from every process, and only
+   if it can take every one of their pages' locks and none of
+   them has accessed it. */
+
+static struct lock frame_lock;          /* Protects the members below
+                                           and each frame's PAGE,
+                                           PIN_CNT and SHARERS. */
+static struct list frames;              /* Frames holding pages. */
+static struct list_elem *hand;          /* Next frame the clock considers. */
+static struct hash shared_frames;       /* Shared frames. */
+
+static hash_hash_func frame_hash;
+static hash_less_func frame_less;
+static struct frame *evict (struct page *);
+static bool evict_shared (struct frame *);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  lock_init (&frame_lock);
+  list_init (&frames);
+  hand = list_end (&frames);
+  if (!hash_init (&shared_frames, frame_hash, frame_less, NULL))
+    PANIC ("shared frame table creation failed");
+}
+
+/* Returns a frame for PAGE, pinned, evicting another page to
+   make room if the user pool is empty.  Returns a null pointer
+   if no frame can be had. */
+struct frame *
+frame_alloc (struct page *page)
+{
+  void *kpage = palloc_get_page (PAL_USER);
+  struct frame *f;
+
+  if (kpage == NULL)
+    return evict (page);
+
+  f = malloc (sizeof *f);
+  if (f == NULL)
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  f->kpage = kpage;
+  f->page = page;
+  f->pin_cnt = 1;
+  f->inode = NULL;
+
+  lock_acquire (&frame_lock);
+  list_push_back (&frames, &f->elem);
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Removes frame F from the frame list and frees it.
+   frame_lock must be held. */
+static void
+remove_frame (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Frees frame F, which must not be shared.  Its page must not be
+   mapped any more. */
+void
+frame_free (struct frame *f)
+{
+  ASSERT (f->inode == NULL);
+
+  lock_acquire (&frame_lock);
+  remove_frame (f);
+  lock_release (&frame_lock);
+}
+
+/* Keeps frame F from being evicted until a matching call to
+   frame_unpin(). */
+void
+frame_pin (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  f->pin_cnt++;
+  lock_release (&frame_lock);
+}
+
+/* Undoes one call to frame_pin(), allowing frame F to be evicted
+   again once every pin is gone. */
+void
+frame_unpin (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  ASSERT (f->pin_cnt > 0);
+  f->pin_cnt--;
+  lock_release (&frame_lock);
+}
+
+/* Fills in the shared frame table key of F from read-only
+   executable page P. */
+static void
+set_key (struct frame *f, const struct page *p)
+{
+  f->inode = file_get_inode (p->file);
+  f->ofs = p->file_ofs;
+  f->read_bytes = p->read_bytes;
+}
+
+/* Returns the shared frame that holds the same contents as page
+   P, or a null pointer if there is none.  frame_lock must be
+   held. */
+static struct frame *
+find_shared (const struct page *p)
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  set_key (&key, p);
+  e = hash_find (&shared_frames, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct frame, hash_elem) : NULL;
+}
+
+/* Looks for a shared frame already holding read-only executable
+   page P and, if there is one, adds P to the pages that map it
+   and returns it.  Returns a null pointer otherwise.  P's lock
+   must be held, which keeps the frame from being evicted until
+   P is mapped to it. */
+struct frame *
+frame_share (struct page *p)
+{
+  struct frame *f;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  lock_acquire (&frame_lock);
+  f = find_shared (p);
+  if (f != NULL)
+    list_push_back (&f->sharers, &p->share_elem);
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Makes F, a frame just read in for read-only executable page P,
+   shared, and returns it.  If another process has meanwhile read
+   in the same page, adds P to that frame instead and returns it,
+   and the caller should free F.  P's lock must be held. */
+struct frame *
+frame_publish (struct frame *f, struct page *p)
+{
+  struct frame *shared;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (f->page == p && f->inode == NULL);
+
+  lock_acquire (&frame_lock);
+  shared = find_shared (p);
+  if (shared == NULL)
+    {
+      shared = f;
+      set_key (f, p);
+      f->page = NULL;
+      list_init (&f->sharers);
+      hash_insert (&shared_frames, &f->hash_elem);
+    }
+  list_push_back (&shared->sharers, &p->share_elem);
+  lock_release (&frame_lock);
+  return shared;
+}
+
+/* Removes page P, which must no longer be mapped or pinned, from
+   the pages that map shared frame F, freeing F if P was the last
+   one. */
+void
+frame_unshare (struct frame *f, struct page *p)
+{
+  ASSERT (f->inode != NULL);
+
+  lock_acquire (&frame_lock);
+  list_remove (&p->share_elem);
+  if (list_empty (&f->sharers))
+    {
+      hash_delete (&shared_frames, &f->hash_elem);
+      remove_frame (f);
+    }
+  lock_release (&frame_lock);
+}
+
+/* Chooses a frame by the clock algorithm, evicts its page, and
+   returns it, pinned, for PAGE.  Returns a null pointer if two
+   sweeps of the clock find nothing to evict. */
+static struct frame *
+evict (struct page *page)
+{
+  size_t tries;
+
+  lock_acquire (&frame_lock);
+  for (tries = 2 * list_size (&frames); tries > 0; tries--)
+    {
+      struct frame *f;
+      struct page *victim;
+      bool evicted;
+
+      if (hand == list_end (&frames))
+        hand = list_begin (&frames);
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      if (f->pin_cnt > 0)
+        continue;
+      if (f->inode != NULL)
+        {
+          if (!evict_shared (f))
+            continue;
+          f->page = page;
+          f->pin_cnt = 1;
+          lock_release (&frame_lock);
+          return f;
+        }
+
+      victim = f->page;
+      if (!lock_try_acquire (&victim->lock))
+        continue;
+      if (page_accessed (victim))
+        {
+          lock_release (&victim->lock);
+          continue;
+        }
+
+      /* Write the victim out without holding frame_lock, so that
+         other frames can come and go meanwhile. */
+      f->pin_cnt = 1;
+      lock_release (&frame_lock);
+      evicted = page_evict (victim);
+      lock_release (&victim->lock);
+      lock_acquire (&frame_lock);
+
+      if (evicted)
+        {
+          f->page = page;
+          lock_release (&frame_lock);
+          return f;
+        }
+      f->pin_cnt = 0;
+    }
+  lock_release (&frame_lock);
+  return NULL;
+}
+
+/* Releases the locks of the pages that map shared frame F, from
+   the first up to but not including STOP. */
+static void
+release_sharers (struct frame *f, struct list_elem *stop)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->sharers); e != stop; e = list_next (e))
+    lock_release (&list_entry (e, struct page, share_elem)->lock);
+}
+
+/* Evicts shared frame F, which must not be pinned, by unmapping
+   it from every page that maps it, and removes it from the
+   shared frame table.  Returns false, leaving F alone, if any of
+   those pages' locks is held or any of them has been accessed
+   since the clock last came by.  frame_lock must be held. */
+static bool
+evict_shared (struct frame *f)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (f->inode != NULL && f->pin_cnt == 0);
+
+  for (e = list_begin (&f->sharers); e != list_end (&f->sharers);
+       e = list_next (e))
+    if (!lock_try_acquire (&list_entry (e, struct page, share_elem)->lock))
+      {
+        release_sharers (f, e);
+        return false;
+      }
+
+  /* Check every page, so that every accessed bit is cleared. */
+  for (e = list_begin (&f->sharers); e != list_end (&f->sharers);
+       e = list_next (e))
+    if (page_accessed (list_entry (e, struct page, share_elem)))
+      accessed = true;
+  if (accessed)
+    {
+      release_sharers (f, list_end (&f->sharers));
+      return false;
+    }
+
+  /* The pages are read only, so there is nothing to write out:
+     each can be read from the executable again. */
+  for (e = list_begin (&f->sharers); e != list_end (&f->sharers);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, share_elem);
+      pagedir_clear_page (p->pagedir, p->upage);
+      p->frame = NULL;
+    }
+  release_sharers (f, list_end (&f->sharers));
+  hash_delete (&shared_frames, &f->hash_elem);
+  f->inode = NULL;
+  return true;
+}
+
+/* Returns a hash value for shared frame E. */
+static unsigned
+frame_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, hash_elem);
+  return (hash_bytes (&f->inode, sizeof f->inode)
+          ^ hash_int (f->ofs) ^ hash_int (f->read_bytes));
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, hash_elem);
+  const struct frame *b = hash_entry (b_, struct frame, hash_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
@@ -0,0 +1,43 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct inode;
+struct page;
+
+/* A frame of physical memory from the user pool, holding a
+   page of some process's virtual memory, or a read-only page of
+   an executable shared by every process that runs it. */
+struct frame
+  {
+    struct list_elem elem;              /* Element in frame list. */
+    void *kpage;                        /* Kernel virtual address. */
+    struct page *page;                  /* Page held, if not shared. */
+    unsigned pin_cnt;                   /* Not to be evicted while
+                                           nonzero. */
+
+    /* Shared frames only. */
+    struct hash_elem hash_elem;         /* Element in shared frame table. */
+    struct inode *inode;                /* Executable, or null if not
+                                           shared. */
+    off_t ofs;                          /* Offset in INODE. */
+    size_t read_bytes;                  /* Bytes read from INODE. */
+    struct list sharers;                /* Pages mapping this frame. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *);
+void frame_free (struct frame *);
+void frame_pin (struct frame *);
+void frame_unpin (struct frame *);
+
+struct frame *frame_share (struct page *);
+struct frame *frame_publish (struct frame *, struct page *);
+void frame_unshare (struct frame *, struct page *);
+
+#endif /* vm/frame.h */
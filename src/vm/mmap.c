@@ -0,0 +1,154 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.
+
+   Mapping a file adds a page to the process's supplemental page
+   table for each page of the file, which is read in from the
+   file when first touched, like a page of an executable.  The
+   difference is that a mapped page that has changed is written
+   back to the file, when it is evicted and when it is unmapped,
+   instead of to swap. */
+
+/* A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;              /* Element in thread's MAPPINGS. */
+    int id;                             /* Mapping identifier. */
+    struct file *file;                  /* File, reopened for the mapping. */
+    uint8_t *addr;                      /* Address of first page. */
+    size_t page_cnt;                    /* Number of pages. */
+  };
+
+static struct mapping *find_mapping (int id);
+static void unmap (struct mapping *);
+
+/* Initializes the running process's list of mappings. */
+void
+mmap_init (void)
+{
+  struct thread *t = thread_current ();
+
+  list_init (&t->mappings);
+  t->next_mapid = 0;
+}
+
+/* Maps FILE into the running process's memory at ADDR, which
+   must be page-aligned, and returns the mapping's identifier.
+   Returns -1 if FILE is empty, if ADDR is not suitable,
+   if any page of the mapping would overlap a page already in
+   use, or if memory is short. */
+int
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  off_t length = file_length (file);
+  struct mapping *m;
+  size_t i;
+
+  if (addr == NULL || pg_ofs (addr) != 0 || length == 0)
+    return -1;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return -1;
+  m->addr = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      uint8_t *upage = m->addr + i * PGSIZE;
+      if (!is_user_vaddr (upage) || upage < m->addr
+          || page_lookup (upage) != NULL)
+        {
+          free (m);
+          return -1;
+        }
+    }
+
+  /* Reopen the file, so that the mapping outlives the file
+     descriptor it came from. */
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return -1;
+    }
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!page_add_mmap (m->addr + ofs, m->file, ofs, read_bytes))
+        {
+          m->page_cnt = i;
+          unmap (m);
+          return -1;
+        }
+    }
+
+  m->id = t->next_mapid++;
+  list_push_back (&t->mappings, &m->elem);
+  return m->id;
+}
+
+/* Unmaps the running process's mapping ID, writing its changed
+   pages back to the file.  Returns false if there is no such
+   mapping. */
+bool
+mmap_unmap (int id)
+{
+  struct mapping *m = find_mapping (id);
+
+  if (m == NULL)
+    return false;
+  list_remove (&m->elem);
+  unmap (m);
+  return true;
+}
+
+/* Unmaps every mapping of the running process, as it exits. */
+void
+mmap_unmap_all (void)
+{
+  struct list *mappings = &thread_current ()->mappings;
+
+  while (!list_empty (mappings))
+    unmap (list_entry (list_pop_front (mappings), struct mapping, elem));
+}
+
+/* Returns the running process's mapping ID, or a null pointer
+   if there is none. */
+static struct mapping *
+find_mapping (int id)
+{
+  struct list *mappings = &thread_current ()->mappings;
+  struct list_elem *e;
+
+  for (e = list_begin (mappings); e != list_end (mappings); e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == id)
+        return m;
+    }
+  return NULL;
+}
+
+/* Removes the pages of mapping M, which must not be in any list,
+   writing back those that have changed, and frees M. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->addr + i * PGSIZE);
+  file_close (m->file);
+  free (m);
+}
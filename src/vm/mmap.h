@@ -0,0 +1,13 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <stdbool.h>
+
+struct file;
+
+void mmap_init (void);
+int mmap_map (struct file *, void *addr);
+bool mmap_unmap (int id);
+void mmap_unmap_all (void);
+
+#endif /* vm/mmap.h */
@@ -0,0 +1,495 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each process records every page of its virtual memory here,
+   with where the page's contents are while it is not in memory:
+   in a swap slot, if it has been written since it was set up,
+   otherwise in a range of a file followed by zeros.  A page of a
+   memory-mapped file is different: its changes are written back
+   to the file, never to swap, and only if it is dirty.  A page is
+   not given a frame or read in until the process first touches
+   it, when the page fault handler calls page_load().  So starting
+   a program takes about the same time however large it is, and
+   pages it never touches cost nothing but their entries here.
+
+   A process's stack starts out as one page and grows a page at a
+   time, as the process touches the pages below it, down to
+   STACK_MAX bytes below PHYS_BASE.
+
+   A read-only page of the executable is shared with every other
+   process running the same program: it is read in once, and the
+   frame is mapped into each process that touches the page.
+
+   A page's lock is held while it is read in or written out, so
+   that its process and the frame table's clock do not both work
+   on it at once. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+
+/* Initializes the running process's supplemental page table.
+   Returns false if memory is short. */
+bool
+page_table_init (void)
+{
+  struct thread *t = thread_current ();
+
+  list_init (&t->pinned_pages);
+  return hash_init (&t->pages, page_hash, page_less, NULL);
+}
+
+/* Destroys the running process's supplemental page table,
+   freeing its frames and swap slots.  Must be called before the
+   page directory is destroyed. */
+void
+page_table_destroy (void)
+{
+  hash_destroy (&thread_current ()->pages, page_destroy);
+}
+
+/* Adds a page at UPAGE, with no contents yet, to the running
+   process's supplemental page table and returns it.  Returns a
+   null pointer if UPAGE is already there or memory is short. */
+static struct page *
+page_add (void *upage, bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->writable = writable;
+  p->pagedir = t->pagedir;
+  lock_init (&p->lock);
+  p->frame = NULL;
+  p->swap_slot = SWAP_NONE;
+  p->pinned = false;
+  p->file = NULL;
+  p->file_ofs = 0;
+  p->read_bytes = 0;
+  p->mmap = false;
+  if (hash_insert (&t->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Adds a page at UPAGE to the running process, whose contents
+   are READ_BYTES bytes read from FILE starting at offset OFS,
+   followed by zeros.  FILE must stay open as long as the page
+   exists.  Returns false if UPAGE is already in use or memory is
+   short. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = page_add (upage, writable);
+  if (p == NULL)
+    return false;
+  p->file = read_bytes > 0 ? file : NULL;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  return true;
+}
+
+/* Adds a page of zeros at UPAGE to the running process.
+   Returns false if UPAGE is already in use or memory is
+   short. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  return page_add (upage, writable) != NULL;
+}
+
+/* Adds a page at UPAGE to the running process that maps the
+   READ_BYTES bytes of FILE starting at offset OFS, followed by
+   zeros.  Changes to the page are written back to FILE, which
+   must stay open as long as the page exists.  Returns false if
+   UPAGE is already in use or memory is short. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  struct page *p;
+
+  ASSERT (read_bytes > 0 && read_bytes <= PGSIZE);
+
+  p = page_add (upage, true);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->mmap = true;
+  return true;
+}
+
+/* Writes page P, which must be in a frame and unmapped, back to
+   its file if it is a page of a memory-mapped file that has
+   changed. */
+static void
+write_back (struct page *p)
+{
+  if (p->mmap && pagedir_is_dirty (p->pagedir, p->upage))
+    {
+      file_write_at (p->file, p->frame->kpage, p->read_bytes, p->file_ofs);
+      pagedir_set_dirty (p->pagedir, p->upage, false);
+    }
+}
+
+/* Removes the running process's page at UPAGE, writing it back
+   to its file first if it is a changed page of a memory-mapped
+   file. */
+void
+page_remove (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL);
+
+  hash_delete (&thread_current ()->pages, &p->hash_elem);
+  page_destroy (&p->hash_elem, NULL);
+}
+
+/* Returns the running process's page that contains UADDR, or a
+   null pointer if there is none. */
+struct page *
+page_lookup (const void *uaddr)
+{
+  struct page key;
+  struct hash_elem *e;
+
+  key.upage = pg_round_down (uaddr);
+  e = hash_find (&thread_current ()->pages, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Returns true if page P is a read-only page of an executable,
+   which can share a frame with the same page in other processes
+   running the same program. */
+static bool
+is_shareable (const struct page *p)
+{
+  return p->file != NULL && !p->writable && !p->mmap;
+}
+
+/* Maps page P to shared frame F, which P has just joined.
+   Pins F if PIN is true.  Returns false, leaving F, if P cannot
+   be mapped. */
+static bool
+map_shared (struct page *p, struct frame *f, bool pin)
+{
+  if (!pagedir_set_page (p->pagedir, p->upage, f->kpage, false))
+    {
+      frame_unshare (f, p);
+      return false;
+    }
+  p->frame = f;
+  if (pin)
+    frame_pin (f);
+  return true;
+}
+
+/* Brings page P into a frame, if it is not in one, and maps it.
+   Pins the frame if PIN is true.  P's lock must be held.
+   Returns false if P cannot be read in. */
+static bool
+load (struct page *p, bool pin)
+{
+  struct frame *f = p->frame;
+  bool from_swap = p->swap_slot != SWAP_NONE;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  if (f != NULL)
+    {
+      if (pin)
+        frame_pin (f);
+      return true;
+    }
+  if (is_shareable (p))
+    {
+      f = frame_share (p);
+      if (f != NULL)
+        return map_shared (p, f, pin);
+    }
+
+  f = frame_alloc (p);
+  if (f == NULL)
+    return false;
+  if (from_swap)
+    {
+      swap_in (p->swap_slot, f->kpage);
+      p->swap_slot = SWAP_NONE;
+    }
+  else
+    {
+      if (p->file != NULL
+          && file_read_at (p->file, f->kpage, p->read_bytes,
+                           p->file_ofs) != (off_t) p->read_bytes)
+        {
+          frame_free (f);
+          return false;
+        }
+      memset ((uint8_t *) f->kpage + p->read_bytes, 0,
+              PGSIZE - p->read_bytes);
+    }
+  if (is_shareable (p))
+    {
+      struct frame *shared = frame_publish (f, p);
+      if (shared != f)
+        {
+          frame_free (f);
+          return map_shared (p, shared, pin);
+        }
+      if (!pagedir_set_page (p->pagedir, p->upage, f->kpage, false))
+        {
+          frame_unpin (f);
+          frame_unshare (f, p);
+          return false;
+        }
+      p->frame = f;
+      if (!pin)
+        frame_unpin (f);
+      return true;
+    }
+  if (!pagedir_set_page (p->pagedir, p->upage, f->kpage, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+
+  /* The swap slot is gone, so the page must be written out again
+     when it is next evicted, changed or not. */
+  if (from_swap)
+    pagedir_set_dirty (p->pagedir, p->upage, true);
+
+  p->frame = f;
+  if (!pin)
+    frame_unpin (f);
+  return true;
+}
+
+/* Returns true if an access to UADDR, where the running process
+   has no page, should grow its stack: if UADDR is within
+   STACK_MAX bytes of PHYS_BASE, and not more than 32 bytes below
+   the process's stack pointer, as the PUSHA instruction may
+   access. */
+static bool
+is_stack_access (const void *uaddr)
+{
+  const uint8_t *esp = thread_current ()->user_esp;
+
+  return ((const uint8_t *) uaddr >= (uint8_t *) PHYS_BASE - STACK_MAX
+          && (const uint8_t *) uaddr + 32 >= esp);
+}
+
+/* Looks up the running process's page that contains UADDR,
+   adding a page of zeros there if the access grows the stack,
+   and brings it into memory as load() does.  Returns false if
+   there is no such page, if WRITE is true and the page is read
+   only, or if it cannot be read in.  If PIN is true, also pins
+   the page, if it is not pinned already, until page_unpin_all()
+   is called. */
+static struct page *
+lookup_and_load (const void *uaddr, bool write, bool pin)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  bool success;
+
+  if (!is_user_vaddr (uaddr))
+    return NULL;
+  p = page_lookup (uaddr);
+  if (p == NULL && is_stack_access (uaddr))
+    p = page_add (pg_round_down (uaddr), true);
+  if (p == NULL || (write && !p->writable))
+    return NULL;
+
+  lock_acquire (&p->lock);
+  pin = pin && !p->pinned;
+  success = load (p, pin);
+  if (success && pin)
+    {
+      p->pinned = true;
+      list_push_back (&t->pinned_pages, &p->pin_elem);
+    }
+  lock_release (&p->lock);
+  return success ? p : NULL;
+}
+
+/* Makes sure that the running process's page that contains
+   UADDR is in memory, reading it in if not.  Returns false if
+   there is no such page, if WRITE is true and the page is read
+   only, or if it cannot be read in. */
+bool
+page_load (const void *uaddr, bool write)
+{
+  return lookup_and_load (uaddr, write, false) != NULL;
+}
+
+/* Brings in the running process's page that contains UADDR, as
+   page_load() does, and keeps it in memory until
+   page_unpin_all() is called, so that the kernel and the disk
+   can use it without faulting.  If WRITE is true, the page is
+   marked dirty, since a disk transfer into it would not be
+   noticed by the MMU. */
+bool
+page_pin (const void *uaddr, bool write)
+{
+  struct page *p = lookup_and_load (uaddr, write, true);
+
+  if (p == NULL)
+    return false;
+  if (write)
+    pagedir_set_dirty (p->pagedir, p->upage, true);
+  return true;
+}
+
+/* Unpins every page pinned by the running process with
+   page_pin(). */
+void
+page_unpin_all (void)
+{
+  struct list *pinned = &thread_current ()->pinned_pages;
+
+  while (!list_empty (pinned))
+    {
+      struct page *p = list_entry (list_pop_front (pinned),
+                                   struct page, pin_elem);
+      p->pinned = false;
+      frame_unpin (p->frame);
+    }
+}
+
+/* Returns true if page P, which must be in a frame, has been
+   accessed since the last call, and clears its accessed bit.
+   P's lock must be held. */
+bool
+page_accessed (struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->frame != NULL);
+
+  if (!pagedir_is_accessed (p->pagedir, p->upage))
+    return false;
+  pagedir_set_accessed (p->pagedir, p->upage, false);
+  return true;
+}
+
+/* Evicts page P from its frame, which must be pinned, writing it
+   to its file if it is a changed page of a memory-mapped file,
+   or to swap if it is any other changed page.  P's lock must be
+   held.  Returns false, leaving P in place, if P must be written
+   to swap but swap is full, or to its file by a thread that is
+   inside a file system operation.  Writing P back would then
+   make its metadata part of that operation, which has not set
+   aside room in the journal for it, so P is left for an
+   eviction from some other context. */
+bool
+page_evict (struct page *p)
+{
+  struct frame *f = p->frame;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (f != NULL && f->pin_cnt > 0 && f->inode == NULL);
+
+  /* Unmap the page first, so that the process faults rather than
+     changing it while it is written out.  Clearing the mapping
+     keeps the dirty bit. */
+  pagedir_clear_page (p->pagedir, p->upage);
+  if (p->mmap)
+    {
+      if (thread_current ()->journal_depth > 0
+          && pagedir_is_dirty (p->pagedir, p->upage))
+        goto keep;
+      write_back (p);
+    }
+  else if (pagedir_is_dirty (p->pagedir, p->upage))
+    {
+      p->swap_slot = swap_out (f->kpage);
+      if (p->swap_slot == SWAP_NONE)
+        goto keep;
+    }
+  p->frame = NULL;
+  return true;
+
+ keep:
+  pagedir_set_page (p->pagedir, p->upage, f->kpage, p->writable);
+  pagedir_set_dirty (p->pagedir, p->upage, true);
+  return false;
+}
+
+/* Returns a hash value for the page that E is embedded in. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+
+  return a->upage < b->upage;
+}
+
+/* Frees the page that E is embedded in, with its frame or swap
+   slot, writing it back first if it is a changed page of a
+   memory-mapped file.  A shared frame is only let go of, and
+   freed once no process maps it.  Waits for the clock to finish
+   with the page first. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+
+  lock_acquire (&p->lock);
+  if (p->pinned)
+    {
+      list_remove (&p->pin_elem);
+      frame_unpin (p->frame);
+    }
+  if (p->frame != NULL)
+    {
+      pagedir_clear_page (p->pagedir, p->upage);
+      if (p->frame->inode != NULL)
+        frame_unshare (p->frame, p);
+      else
+        {
+          write_back (p);
+          frame_free (p->frame);
+        }
+    }
+  if (p->swap_slot != SWAP_NONE)
+    swap_free (p->swap_slot);
+  lock_release (&p->lock);
+  free (p);
+}
@@ -0,0 +1,60 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct file;
+
+/* Most bytes of user memory, below PHYS_BASE, that a process's
+   stack may grow to cover. */
+#define STACK_MAX (8 * 1024 * 1024)
+
+/* A page of a process's virtual memory, as recorded in its
+   supplemental page table. */
+struct page
+  {
+    struct hash_elem hash_elem;         /* Element in thread's PAGES. */
+    void *upage;                        /* User virtual address. */
+    bool writable;                      /* Writable by the process? */
+    uint32_t *pagedir;                  /* Owning process's page directory. */
+
+    struct lock lock;                   /* Held while loading or evicting. */
+    struct frame *frame;                /* Frame, or null if not loaded. */
+    size_t swap_slot;                   /* Swap slot, or SWAP_NONE. */
+    bool pinned;                        /* On thread's PINNED_PAGES? */
+    struct list_elem pin_elem;          /* Element in PINNED_PAGES. */
+    struct list_elem share_elem;        /* Element in shared frame's
+                                           SHARERS. */
+
+    /* Initial contents. */
+    struct file *file;                  /* File to read, or null. */
+    off_t file_ofs;                     /* Offset in FILE. */
+    size_t read_bytes;                  /* Bytes read from FILE, the rest
+                                           of the page being zeroed. */
+    bool mmap;                          /* Changes written back to FILE
+                                           rather than to swap? */
+  };
+
+bool page_table_init (void);
+void page_table_destroy (void);
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes);
+void page_remove (void *upage);
+struct page *page_lookup (const void *uaddr);
+bool page_load (const void *uaddr, bool write);
+bool page_pin (const void *uaddr, bool write);
+void page_unpin_all (void);
+
+bool page_accessed (struct page *);
+bool page_evict (struct page *);
+
+#endif /* vm/page.h */
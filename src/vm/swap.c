@@ -0,0 +1,74 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap space.
+
+   The swap device is divided into slots, each of which holds one
+   page in SECTORS_PER_SLOT consecutive sectors, moved to or from
+   the device as a single request. */
+
+/* Sectors per swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;       /* Swap device, or null. */
+static struct bitmap *used_slots;       /* Slots in use. */
+static struct lock swap_lock;           /* Protects USED_SLOTS. */
+
+/* Initializes swap space on the swap device, if there is one. */
+void
+swap_init (void)
+{
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+
+  used_slots = bitmap_create (block_size (swap_device) / SECTORS_PER_SLOT);
+  if (used_slots == NULL)
+    PANIC ("swap slot bitmap creation failed");
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot, or SWAP_NONE if swap is full or there is none. */
+size_t
+swap_out (const void *kpage)
+{
+  size_t slot = BITMAP_ERROR;
+
+  if (swap_device != NULL)
+    {
+      lock_acquire (&swap_lock);
+      slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+      lock_release (&swap_lock);
+    }
+  if (slot == BITMAP_ERROR)
+    return SWAP_NONE;
+
+  block_write_multiple (swap_device, slot * SECTORS_PER_SLOT,
+                        SECTORS_PER_SLOT, kpage);
+  return slot;
+}
+
+/* Reads the page in swap slot SLOT into KPAGE and frees the
+   slot. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  block_read_multiple (swap_device, slot * SECTORS_PER_SLOT,
+                       SECTORS_PER_SLOT, kpage);
+  swap_free (slot);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  bitmap_reset (used_slots, slot);
+  lock_release (&swap_lock);
+}